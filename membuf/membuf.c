@@ -4,6 +4,16 @@
 #include <linux/fs.h>
 #include <linux/cdev.h>
 #include <linux/string.h>
+#include <linux/uio.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/seqlock.h>
+#include <linux/rcupdate.h>
+#include <linux/srcu.h>
+
+#include "membuf.h"
 
 #define DEVNAME "membuf"
 
@@ -16,8 +26,8 @@
 #define EXIT_SUCCESS 0
 #define EOF 0
 
-#define MAX(x, y) (((x) > (y)) ? (x) : (y));
-#define MIN(x, y) (((x) < (y)) ? (x) : (y));
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("yk");
@@ -28,23 +38,34 @@ static bool kbuffer_allocated = false;
 static bool chrdev_region_allocated = false;
 static bool class_created = false;
 
-static atomic_t open_devices_count = ATOMIC_INIT(0);
+// NOTE: Serializes opens against removal of devices and mode switches of closed ones.
+static DEFINE_MUTEX(devices_lock);
+static atomic_t open_count_array[MAX_DEVICES_COUNT];
 
-static ssize_t dev_read(struct file*, char*, size_t, loff_t*);
-static ssize_t dev_write(struct file*, const char*, size_t, loff_t*);
+static ssize_t dev_read_iter(struct kiocb*, struct iov_iter*);
+static ssize_t dev_write_iter(struct kiocb*, struct iov_iter*);
 static int dev_open(struct inode*, struct file*);
 static int dev_release(struct inode*, struct file*);
+static int dev_mmap(struct file*, struct vm_area_struct*);
+static long dev_ioctl(struct file*, unsigned int, unsigned long);
+static __poll_t dev_poll(struct file*, poll_table*);
 
 static int buffer_size_getter(char *buffer, const struct kernel_param *kp);
 static int buffer_size_setter(const char *raw_value, const struct kernel_param *kparam);
 static int devices_count_setter(const char *raw_value, const struct kernel_param *param);
+static int ring_mode_getter(char *buffer, const struct kernel_param *kp);
+static int ring_mode_setter(const char *raw_value, const struct kernel_param *kparam);
 
 static struct file_operations operations = {
   .owner = THIS_MODULE,
-  .read = dev_read,
-  .write = dev_write,
+  .read_iter = dev_read_iter,
+  .write_iter = dev_write_iter,
   .open = dev_open,
   .release = dev_release,
+  .mmap = dev_mmap,
+  .unlocked_ioctl = dev_ioctl,
+  .compat_ioctl = compat_ptr_ioctl,
+  .poll = dev_poll,
 };
 
 static struct cdev *cdev_array;
@@ -55,7 +76,47 @@ dev_t dev = 0;
 
 static int devices_count = INITIAL_DEVICES_COUNT;
 static int buffer_size_data[MAX_DEVICES_COUNT];
-static char **kbuffer;
+static struct membuf_buffer __rcu **kbuffer;
+static atomic64_t generation_array[MAX_DEVICES_COUNT];
+
+// NOTE: Writers bump the seqcount around their copy under the per-device mutex, readers copy
+// without any lock and take the mutex only if a writer got in their way. A reader never
+// spins on an odd count, so writers are free to sleep on a page fault in the middle.
+static seqcount_t seq_array[MAX_DEVICES_COUNT];
+
+// NOTE: In ring mode the device buffer is a FIFO of buffer_size_data[minor] bytes. head and
+// tail only grow, the producer owns head and the consumer owns tail, so with a single
+// producer and a single consumer neither side waits for the other. Producers serialize
+// on write_lock and consumers on read_lock, the per-device mutex is not taken at all.
+struct membuf_ring {
+  unsigned long head;
+  unsigned long tail;
+  struct mutex write_lock;
+  struct mutex read_lock;
+  wait_queue_head_t write_queue;
+  wait_queue_head_t read_queue;
+};
+
+static int ring_mode_data[MAX_DEVICES_COUNT];
+static struct membuf_ring ring_array[MAX_DEVICES_COUNT];
+
+// NOTE: A buffer is published together with its size, so a reader never sees one without
+// the other. Resizes publish a new one with RCU and free the old one once the readers that
+// may still copy from it are done. Readers hold kbuffer_srcu since copying to user space
+// can sleep; everybody else holds mutex_array[minor] or, in ring mode, one of the ring
+// locks, which resizes take as well.
+struct membuf_buffer {
+  int size;
+  char *data;
+};
+
+DEFINE_STATIC_SRCU(kbuffer_srcu);
+
+static struct membuf_buffer *locked_kbuffer(int minor) {
+  return rcu_dereference_protected(kbuffer[minor], lockdep_is_held(&mutex_array[minor]) ||
+                                   lockdep_is_held(&ring_array[minor].write_lock) ||
+                                   lockdep_is_held(&ring_array[minor].read_lock));
+}
 
 static const struct kernel_param_ops kparam_buffer_size_ops = {
   .set = buffer_size_setter,
@@ -73,6 +134,14 @@ MODULE_PARM_DESC(buffer_size_data, "Per-device buffer size");
 module_param_cb(devices_count, &kparam_devices_count_ops, &devices_count, S_IWUSR | S_IRUSR);
 MODULE_PARM_DESC(devices_count, "Total devices count");
 
+static const struct kernel_param_ops kparam_ring_mode_ops = {
+  .set = ring_mode_setter,
+  .get = ring_mode_getter,
+};
+
+module_param_cb(ring_mode_data, &kparam_ring_mode_ops, &ring_mode_data, S_IWUSR | S_IRUSR);
+MODULE_PARM_DESC(ring_mode_data, "Per-device FIFO ring mode");
+
 // NOTE: Single locking order guarantees lack of deadlocks.
 // static void acquire_exclusive_lock(void) {
 //   int i;
@@ -90,6 +159,51 @@ MODULE_PARM_DESC(devices_count, "Total devices count");
 //   }
 // }
 
+// NOTE: Buffers are whole vmalloc_user pages so that they can be mapped into user space.
+static struct membuf_buffer *alloc_kbuffer(int size) {
+  struct membuf_buffer *buffer = kmalloc(sizeof(*buffer), GFP_KERNEL);
+
+  if (buffer == NULL) {
+    return NULL;
+  }
+
+  buffer->data = vmalloc_user(size > 0 ? PAGE_ALIGN(size) : PAGE_SIZE);
+  if (buffer->data == NULL) {
+    kfree(buffer);
+    return NULL;
+  }
+  buffer->size = size;
+
+  return buffer;
+}
+
+static void free_kbuffer(struct membuf_buffer *buffer) {
+  if (buffer != NULL) {
+    vfree(buffer->data);
+    kfree(buffer);
+  }
+}
+
+// NOTE: Keeps the oldest bytes of the ring that fit, so the consumer goes on where it was.
+static void ring_resize(struct membuf_ring *ring, struct membuf_buffer *old_buffer, struct membuf_buffer *buffer) {
+  unsigned long i;
+  unsigned long used = MIN(ring->head - ring->tail, (unsigned long) buffer->size);
+
+  for (i = 0; i < used; i++) {
+    buffer->data[i] = old_buffer->data[(ring->tail + i) % old_buffer->size];
+  }
+
+  ring->tail = 0;
+  ring->head = used;
+}
+
+// NOTE: Called under devices_lock with the device closed, so nobody uses the ring.
+static void ring_reset(int minor) {
+  ring_mode_data[minor] = 0;
+  ring_array[minor].head = 0;
+  ring_array[minor].tail = 0;
+}
+
 static int buffer_size_getter(char *buffer, const struct kernel_param *kp) {
   char data[32];
   int i;
@@ -106,80 +220,98 @@ static int buffer_size_getter(char *buffer, const struct kernel_param *kp) {
 }
 
 static int buffer_size_setter(const char *raw_value, const struct kernel_param *kparam) {
-  int ret_value;
   uint device_index;
   uint value;
-  uint initial_value;
-  char *value_buffer, *tmp_buffer, *first_token, *second_token;
-  char *sep = " ";
+  struct membuf_buffer *buffer, *old_buffer;
+  struct membuf_ring *ring;
 
-  if (atomic_read(&open_devices_count) > 0) {
+  if (sscanf(raw_value, "%u %u", &device_index, &value) != 2 || device_index >= devices_count) {
+    printk(KERN_ERR "membuf: invalid parameter 'buffer_size_data' value\n");
     return -EINVAL;
   }
 
-  value_buffer = kzalloc(strlen(raw_value), 0);
-  strcpy(value_buffer, raw_value);
-
-  first_token = strsep(&value_buffer, sep);
-  if (first_token == NULL) {
-    printk(KERN_ERR "membuf: invalid parameter 'buffer_size_data' value\n");
+  if (value > MAX_BUFFER_SIZE) {
+    pr_err("membuf: buffer size value exceeded limit of %d bytes\n", MAX_BUFFER_SIZE);
     return -EINVAL;
   }
 
-  second_token = strsep(&value_buffer, sep);
-  if (second_token == NULL) {
-    printk(KERN_ERR "membuf: invalid parameter 'buffer_size_data' value\n");
-    return -EINVAL;
+  buffer = alloc_kbuffer(value);
+  if (buffer == NULL) {
+    printk(KERN_ERR "membuf: failed to allocate memory\n");
+    return -ENOMEM;
   }
 
-  pr_info("membuf: tokens: first: %s, second: %s\n", first_token, second_token);
+  ring = &ring_array[device_index];
+  mutex_lock(&mutex_array[device_index]);
+  mutex_lock(&ring->write_lock);
+  mutex_lock(&ring->read_lock);
 
-  ret_value = kstrtoint(first_token, 10, &device_index);
-  if (ret_value < 0) {
-    printk(KERN_ERR "membuf: invalid parameter 'buffer_size_data' value\n");
-    return -EINVAL;
+  old_buffer = locked_kbuffer(device_index);
+  if (ring_mode_data[device_index]) {
+    ring_resize(ring, old_buffer, buffer);
+  } else {
+    memcpy(buffer->data, old_buffer->data, MIN(old_buffer->size, buffer->size));
   }
 
-  ret_value = kstrtoint(second_token, 10, &value);
-  if (ret_value < 0) {
-    printk(KERN_ERR "membuf: invalid parameter 'buffer_size_data' value\n");
-    return -EINVAL;
-  }
+  rcu_assign_pointer(kbuffer[device_index], buffer);
+  WRITE_ONCE(buffer_size_data[device_index], value);
+  atomic64_inc(&generation_array[device_index]);
 
-  if (device_index > devices_count) {
-    printk(KERN_ERR "membuf: invalid parameter 'buffer_size_data' value\n");
-    return -EINVAL;
+  mutex_unlock(&ring->read_lock);
+  mutex_unlock(&ring->write_lock);
+  mutex_unlock(&mutex_array[device_index]);
+
+  // waiters may find room or data in a ring of another size
+  wake_up_interruptible_poll(&ring->read_queue, EPOLLIN | EPOLLRDNORM);
+  wake_up_interruptible_poll(&ring->write_queue, EPOLLOUT | EPOLLWRNORM);
+
+  pr_info("membuf: param 'buffer_size_data' updated (devminor=%d, value=%d)\n", device_index, value);
+
+  synchronize_srcu(&kbuffer_srcu);
+  free_kbuffer(old_buffer);
+
+  return EXIT_SUCCESS;
+}
+
+static int ring_mode_getter(char *buffer, const struct kernel_param *kp) {
+  int i;
+  int offset = 0;
+
+  for (i = 0; i < devices_count; i++) {
+    offset += sprintf(buffer + offset, "%d %d\n", i, ring_mode_data[i]);
   }
 
-  initial_value = buffer_size_data[device_index];
-  if (value > MAX_BUFFER_SIZE) {
-    pr_err("membuf: buffer size value exceeded limit of %d bytes\n", MAX_BUFFER_SIZE);
+  return offset;
+}
+
+static int ring_mode_setter(const char *raw_value, const struct kernel_param *kparam) {
+  uint device_index;
+  uint value;
+
+  if (sscanf(raw_value, "%u %u", &device_index, &value) != 2 || device_index >= devices_count || value > 1) {
+    printk(KERN_ERR "membuf: invalid parameter 'ring_mode_data' value\n");
     return -EINVAL;
   }
 
-  value = MIN(value, MAX_BUFFER_SIZE);
-  mutex_lock(&mutex_array[device_index]);
-  buffer_size_data[device_index] = value;
-
-  tmp_buffer = kzalloc(value, 0);
-  memcpy(tmp_buffer, kbuffer[device_index], initial_value);
-  kfree(kbuffer[device_index]);
-  kbuffer[device_index] = tmp_buffer;
+  mutex_lock(&devices_lock);
+  if (atomic_read(&open_count_array[device_index]) > 0) {
+    mutex_unlock(&devices_lock);
+    return -EBUSY;
+  }
 
-  pr_info("membuf: param 'buffer_size_data' updated (devminor=%d, value=%d)\n", device_index, value);
+  ring_reset(device_index);
+  ring_mode_data[device_index] = value;
+  mutex_unlock(&devices_lock);
 
-  mutex_unlock(&mutex_array[device_index]);
+  pr_info("membuf: param 'ring_mode_data' updated (devminor=%d, value=%d)\n", device_index, value);
 
   return EXIT_SUCCESS;
 }
 
 static int devices_count_setter(const char *raw_value, const struct kernel_param *param) {
-  int i, previous_value, value, ret_value;
+  int i, previous_value, value;
   dev_t device_spec;
-
-  if (atomic_read(&open_devices_count) > 0) {
-    return -EINVAL;
-  }
+  struct membuf_buffer *buffer;
 
   previous_value = devices_count;
 
@@ -197,131 +329,367 @@ static int devices_count_setter(const char *raw_value, const struct kernel_param
   }
 
   if (value > previous_value) {
+    for (i = previous_value; i < value; i++) {
+      buffer = alloc_kbuffer(buffer_size_data[i]);
+      if (buffer == NULL) {
+        printk(KERN_ERR "membuf: failed to allocate memory\n");
+        while (--i >= previous_value) {
+          free_kbuffer(rcu_dereference_protected(kbuffer[i], 1));
+          RCU_INIT_POINTER(kbuffer[i], NULL);
+        }
+        return -ENOMEM;
+      }
+      rcu_assign_pointer(kbuffer[i], buffer);
+    }
+
+    // NOTE: A device that comes back starts out of ring mode with an empty ring, whatever
+    // it was left with when it was removed.
+    mutex_lock(&devices_lock);
+    for (i = previous_value; i < value; i++) {
+      ring_reset(i);
+    }
+    devices_count = value;
+    mutex_unlock(&devices_lock);
+
     for (i = previous_value; i < value; i++) {
       device_spec = MKDEV(MAJOR(dev), i);
       cdev_init(&cdev_array[i], &operations);
       cdev_add(&cdev_array[i], device_spec, 1);
       device_create(membuf_class, NULL, device_spec, NULL, "membuf%d", i);
-      kbuffer[i] = kzalloc(buffer_size_data[i], 0);
-      if (kbuffer[i] == NULL) {
-        printk(KERN_ERR "membuf: failed to allocate memory\n");
-        while (i >= previous_value) {
-          kfree(kbuffer[i]);
-          cdev_del(&cdev_array[i]);
-          device_destroy(membuf_class, MKDEV(MAJOR(dev), i));
-        }
-        return -EINVAL;
-      }
     }
   } else if (value < previous_value) {
+    // NOTE: Only the removed devices have to be closed, the others keep working meanwhile.
+    mutex_lock(&devices_lock);
+    for (i = value; i < previous_value; i++) {
+      if (atomic_read(&open_count_array[i]) > 0) {
+        mutex_unlock(&devices_lock);
+        printk(KERN_ERR "membuf: device %d is open, cannot remove it\n", i);
+        return -EBUSY;
+      }
+    }
+    for (i = value; i < previous_value; i++) {
+      ring_reset(i);
+    }
+    devices_count = value;
+    mutex_unlock(&devices_lock);
+
     for (i = value; i < previous_value; i++) {
-      mutex_lock(&mutex_array[i]);
       device_spec = MKDEV(MAJOR(dev), i);
       cdev_del(&cdev_array[i]);
       device_destroy(membuf_class, device_spec);
-      kfree(kbuffer[i]);
-      mutex_unlock(&mutex_array[i]);
+      free_kbuffer(rcu_dereference_protected(kbuffer[i], 1));
+      RCU_INIT_POINTER(kbuffer[i], NULL);
     }
   }
 
   pr_info("membuf: updated 'devices_count' param to %d\n", value);
-  ret_value = param_set_uint(raw_value, param);
-
-  if (ret_value < 0) {
-    for (i = previous_value; i < value; i++) {
-      kfree(kbuffer[i]);
-      cdev_del(&cdev_array[i]);
-      device_destroy(membuf_class, MKDEV(MAJOR(dev), i));
-    }
-    return -EINVAL;
-  }
-
-  devices_count = value;
 
   return EXIT_SUCCESS;
 }
 
 static int dev_open(struct inode *i, struct file *f) {
-  atomic_inc(&open_devices_count);
+  int minor = iminor(i);
+  int ret_value = EXIT_SUCCESS;
 
-  return EXIT_SUCCESS;
+  mutex_lock(&devices_lock);
+  if (minor < devices_count) {
+    atomic_inc(&open_count_array[minor]);
+  } else {
+    ret_value = -ENODEV;
+  }
+  mutex_unlock(&devices_lock);
+
+  return ret_value;
 }
 
 static int dev_release(struct inode *i, struct file *f) {
-  atomic_dec(&open_devices_count);
+  atomic_dec(&open_count_array[iminor(i)]);
 
   return EXIT_SUCCESS;
 }
 
-static ssize_t dev_write(struct file *f, const char *buffer, size_t len, loff_t* offset) {
-  unsigned long to_copy;
-  char* kbuffer_tmp;
-  int failed_write_count;
-  int minor = iminor(file_inode(f));
-
-  pr_info("membuf: write(len=%ld, off=%lld) for device %d\n", len, *offset, minor);
+static bool ring_nonblock(struct kiocb *iocb) {
+  return (iocb->ki_filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+}
 
-  mutex_lock(&mutex_array[minor]);
+// NOTE: A ring write stores as much as fits and only blocks while the ring is full.
+static ssize_t ring_write_iter(struct kiocb *iocb, struct iov_iter *from) {
+  unsigned long head, tail, start, chunk;
+  size_t to_copy, copied;
+  int minor = iminor(file_inode(iocb->ki_filp));
+  struct membuf_ring *ring = &ring_array[minor];
+  struct membuf_buffer *buffer;
+  unsigned long size;
 
-  if (*offset >= buffer_size_data[minor]) {
-    mutex_unlock(&mutex_array[minor]);
+  if (iov_iter_count(from) == 0) {
     return EOF;
-  };
+  }
 
-  if (*offset + len > buffer_size_data[minor]) {
-    to_copy = buffer_size_data[minor] - *offset;
-  } else {
-    to_copy = len;
+  // NOTE: A ring of size 0 never has room, a writer waiting for some when the device shrinks
+  // to 0 gives up as well.
+  for (;;) {
+    if (mutex_lock_interruptible(&ring->write_lock)) {
+      return -ERESTARTSYS;
+    }
+
+    buffer = locked_kbuffer(minor);
+    size = buffer->size;
+    if (size == 0) {
+      mutex_unlock(&ring->write_lock);
+      return -ENOSPC;
+    }
+    head = ring->head;
+    tail = smp_load_acquire(&ring->tail);
+    if (head - tail < size) {
+      break;
+    }
+
+    mutex_unlock(&ring->write_lock);
+    if (ring_nonblock(iocb)) {
+      return -EAGAIN;
+    }
+    if (wait_event_interruptible(ring->write_queue, READ_ONCE(buffer_size_data[minor]) == 0 ||
+                                 READ_ONCE(ring->head) - smp_load_acquire(&ring->tail) <
+                                 READ_ONCE(buffer_size_data[minor]))) {
+      return -ERESTARTSYS;
+    }
   }
 
-  kbuffer_tmp = kzalloc(to_copy, 0);
-  if (kbuffer_tmp == NULL) {
-    printk(KERN_ERR "membuf: failed to allocate tmp buffer for write");
-    mutex_unlock(&mutex_array[minor]);
+  to_copy = MIN(iov_iter_count(from), (size_t) (size - (head - tail)));
+  start = head % size;
+  chunk = MIN(to_copy, size - start);
+  copied = copy_from_iter(buffer->data + start, chunk, from);
+  if (copied == chunk && chunk < to_copy) {
+    copied += copy_from_iter(buffer->data, to_copy - chunk, from);
+  }
 
-    return -ENOMEM;
+  // pairs with the acquire in ring_read_iter, the data is in place before head moves
+  smp_store_release(&ring->head, head + copied);
+  mutex_unlock(&ring->write_lock);
+
+  if (copied == 0) {
+    return -EFAULT;
   }
 
-  failed_write_count = copy_from_user(kbuffer_tmp, buffer, to_copy);
-  if (failed_write_count > 0) { // if we failed to copy entire buffer we prefer to abort entire operation
-    printk(KERN_ERR "Failed to write to tmp buffuer for write");
-    kfree(kbuffer_tmp);
-    mutex_unlock(&mutex_array[minor]);
+  atomic64_inc(&generation_array[minor]);
+  if (wq_has_sleeper(&ring->read_queue)) {
+    wake_up_interruptible_poll(&ring->read_queue, EPOLLIN | EPOLLRDNORM);
+  }
 
+  return copied;
+}
+
+static ssize_t ring_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+  unsigned long head, tail, start, chunk;
+  size_t to_copy, copied;
+  int minor = iminor(file_inode(iocb->ki_filp));
+  struct membuf_ring *ring = &ring_array[minor];
+  struct membuf_buffer *buffer;
+  unsigned long size;
+
+  if (iov_iter_count(to) == 0) {
+    return EOF;
+  }
+
+  for (;;) {
+    if (mutex_lock_interruptible(&ring->read_lock)) {
+      return -ERESTARTSYS;
+    }
+
+    buffer = locked_kbuffer(minor);
+    size = buffer->size;
+    if (size == 0) {
+      mutex_unlock(&ring->read_lock);
+      return EOF;
+    }
+    tail = ring->tail;
+    head = smp_load_acquire(&ring->head);
+    if (head != tail) {
+      break;
+    }
+
+    mutex_unlock(&ring->read_lock);
+    if (ring_nonblock(iocb)) {
+      return -EAGAIN;
+    }
+    if (wait_event_interruptible(ring->read_queue, READ_ONCE(buffer_size_data[minor]) == 0 ||
+                                 smp_load_acquire(&ring->head) != READ_ONCE(ring->tail))) {
+      return -ERESTARTSYS;
+    }
+  }
+
+  to_copy = MIN(iov_iter_count(to), (size_t) (head - tail));
+  start = tail % size;
+  chunk = MIN(to_copy, size - start);
+  copied = copy_to_iter(buffer->data + start, chunk, to);
+  if (copied == chunk && chunk < to_copy) {
+    copied += copy_to_iter(buffer->data, to_copy - chunk, to);
+  }
+
+  // pairs with the acquire in ring_write_iter, the data is read before its space is reused
+  smp_store_release(&ring->tail, tail + copied);
+  mutex_unlock(&ring->read_lock);
+
+  if (copied == 0) {
     return -EFAULT;
   }
 
-  memcpy(kbuffer[minor] + *offset, kbuffer_tmp, to_copy);
-  mutex_unlock(&mutex_array[minor]);
+  if (wq_has_sleeper(&ring->write_queue)) {
+    wake_up_interruptible_poll(&ring->write_queue, EPOLLOUT | EPOLLWRNORM);
+  }
 
-  *offset += to_copy;
-  return to_copy;
+  return copied;
 }
 
-static ssize_t dev_read(struct file *filep, char *buffer, size_t len, loff_t *offset) {
-  unsigned long copy_result;
-  unsigned long to_copy;
-  int minor = iminor(file_inode(filep));
+static __poll_t dev_poll(struct file *f, poll_table *wait) {
+  unsigned long used;
+  __poll_t mask = 0;
+  int minor = iminor(file_inode(f));
+  struct membuf_ring *ring = &ring_array[minor];
+
+  if (!ring_mode_data[minor]) {
+    return EPOLLIN | EPOLLRDNORM | EPOLLOUT | EPOLLWRNORM;
+  }
+
+  poll_wait(f, &ring->read_queue, wait);
+  poll_wait(f, &ring->write_queue, wait);
+
+  // pairs with the barrier in wq_has_sleeper, a wakeup is either seen here or sent to us
+  smp_mb();
+
+  // read and write of a ring of size 0 return at once, with EOF and ENOSPC
+  if (READ_ONCE(buffer_size_data[minor]) == 0) {
+    return EPOLLIN | EPOLLRDNORM | EPOLLOUT | EPOLLWRNORM;
+  }
+
+  used = READ_ONCE(ring->head) - READ_ONCE(ring->tail);
+  if (used > 0) {
+    mask |= EPOLLIN | EPOLLRDNORM;
+  }
+  if (used < READ_ONCE(buffer_size_data[minor])) {
+    mask |= EPOLLOUT | EPOLLWRNORM;
+  }
+
+  return mask;
+}
+
+// NOTE: Both directions copy straight between the iov_iter and the device buffer,
+// so a readv/writev of any number of segments is a single pass.
+static size_t copy_length(struct membuf_buffer *buffer, loff_t offset, size_t len) {
+  if (offset >= buffer->size) {
+    return 0;
+  }
+
+  return MIN(len, (size_t) (buffer->size - offset));
+}
+
+static ssize_t dev_write_iter(struct kiocb *iocb, struct iov_iter *from) {
+  size_t to_copy, copied;
+  struct membuf_buffer *buffer;
+  loff_t offset = iocb->ki_pos;
+  int minor = iminor(file_inode(iocb->ki_filp));
+
+  if (ring_mode_data[minor]) {
+    return ring_write_iter(iocb, from);
+  }
+
+  pr_debug("membuf: write(len=%zu, off=%lld) for device %d\n", iov_iter_count(from), offset, minor);
+
   mutex_lock(&mutex_array[minor]);
+  buffer = locked_kbuffer(minor);
+
+  to_copy = copy_length(buffer, offset, iov_iter_count(from));
+  raw_write_seqcount_begin(&seq_array[minor]);
+  copied = copy_from_iter(buffer->data + offset, to_copy, from);
+  raw_write_seqcount_end(&seq_array[minor]);
+  if (copied > 0) {
+    atomic64_inc(&generation_array[minor]);
+  }
+  mutex_unlock(&mutex_array[minor]);
 
-  pr_info("MEMBUF: read(len=%ld, off=%lld) for device %d\n", len, *offset, minor);
+  if (copied == 0 && to_copy > 0) {
+    return -EFAULT;
+  }
 
-  if (*offset >= buffer_size_data[minor]) {
-    mutex_unlock(&mutex_array[minor]);
-    return EOF;
+  iocb->ki_pos += copied;
+  return copied;
+}
+
+static ssize_t dev_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+  size_t to_copy, copied;
+  struct membuf_buffer *buffer;
+  unsigned int seq;
+  int idx;
+  loff_t offset = iocb->ki_pos;
+  int minor = iminor(file_inode(iocb->ki_filp));
+
+  if (ring_mode_data[minor]) {
+    return ring_read_iter(iocb, to);
   }
 
-  to_copy = MIN(len, buffer_size_data[minor]);
-  copy_result = copy_to_user(buffer, kbuffer[minor] + *offset, to_copy);
-  if (copy_result > 0) {
-    mutex_unlock(&mutex_array[minor]);
+  pr_debug("membuf: read(len=%zu, off=%lld) for device %d\n", iov_iter_count(to), offset, minor);
+
+  idx = srcu_read_lock(&kbuffer_srcu);
+
+  seq = raw_read_seqcount(&seq_array[minor]);
+  if (!(seq & 1)) {
+    buffer = srcu_dereference(kbuffer[minor], &kbuffer_srcu);
+    to_copy = copy_length(buffer, offset, iov_iter_count(to));
+    copied = copy_to_iter(buffer->data + offset, to_copy, to);
+    if (!read_seqcount_retry(&seq_array[minor], seq)) {
+      goto out;
+    }
+    iov_iter_revert(to, copied);
+  }
+
+  mutex_lock(&mutex_array[minor]);
+  buffer = locked_kbuffer(minor);
+  to_copy = copy_length(buffer, offset, iov_iter_count(to));
+  copied = copy_to_iter(buffer->data + offset, to_copy, to);
+  mutex_unlock(&mutex_array[minor]);
+
+out:
+  srcu_read_unlock(&kbuffer_srcu, idx);
+
+  if (copied == 0 && to_copy > 0) {
     return -EFAULT;
   }
 
+  iocb->ki_pos += copied;
+  return copied;
+}
+
+// NOTE: The mapping shares the pages of the current buffer. A resize replaces the buffer
+// and bumps the generation, so the device has to be mapped again to see the new one.
+static int dev_mmap(struct file *f, struct vm_area_struct *vma) {
+  int ret_value;
+  int minor = iminor(file_inode(f));
+
+  mutex_lock(&mutex_array[minor]);
+  ret_value = remap_vmalloc_range(vma, locked_kbuffer(minor)->data, vma->vm_pgoff);
   mutex_unlock(&mutex_array[minor]);
-  *offset += to_copy;
 
-  return to_copy;
+  return ret_value;
+}
+
+static long dev_ioctl(struct file *f, unsigned int cmd, unsigned long arg) {
+  u64 generation;
+  u32 size;
+  int minor = iminor(file_inode(f));
+
+  switch (cmd) {
+  case MEMBUF_IOC_GET_GENERATION:
+    generation = atomic64_read(&generation_array[minor]);
+    return put_user(generation, (u64 __user *) arg);
+  case MEMBUF_IOC_BUMP_GENERATION:
+    generation = atomic64_inc_return(&generation_array[minor]);
+    return put_user(generation, (u64 __user *) arg);
+  case MEMBUF_IOC_GET_SIZE:
+    size = READ_ONCE(buffer_size_data[minor]);
+    return put_user(size, (u32 __user *) arg);
+  default:
+    return -ENOTTY;
+  }
 }
 
 static void dealocate_kbuffer(void) {
@@ -329,9 +697,7 @@ static void dealocate_kbuffer(void) {
 
   if (kbuffer != NULL) {
     for (i = 0; i < devices_count; i++) {
-      if (kbuffer[i] != NULL) {
-        kfree(kbuffer[i]);
-      }
+      free_kbuffer(rcu_dereference_protected(kbuffer[i], 1));
     }
     kfree(kbuffer);
   }
@@ -343,6 +709,7 @@ static int __init kmodule_membuf_init(void) {
   int retval = -1;
   int major;
   dev_t my_device;
+  struct membuf_buffer *buffer;
 
   cdev_array = kmalloc(MAX_DEVICES_COUNT * sizeof(struct cdev), 0);
   mutex_array = kmalloc(MAX_DEVICES_COUNT * sizeof(struct mutex), 0);
@@ -351,7 +718,7 @@ static int __init kmodule_membuf_init(void) {
     buffer_size_data[i] = INITIAL_BUFFER_SIZE;
   }
 
-  kbuffer = (char **) kzalloc(MAX_DEVICES_COUNT * sizeof(char *), 0);
+  kbuffer = (struct membuf_buffer __rcu **) kzalloc(MAX_DEVICES_COUNT * sizeof(*kbuffer), 0);
   if (kbuffer == NULL) {
     goto module_cleanup;
     printk(KERN_ERR "membuf: failed to allocate memory\n");
@@ -359,22 +726,24 @@ static int __init kmodule_membuf_init(void) {
   }
 
   for (i = 0; i < devices_count; i++) {
-    kbuffer[i] = kzalloc(buffer_size_data[i], 0);
-    if (kbuffer[i] == NULL) {
+    buffer = alloc_kbuffer(buffer_size_data[i]);
+    if (buffer == NULL) {
       printk(KERN_ERR "membuf: failed to allocate memory for buffer\n");
-      while (i > 0) {
-        kfree(kbuffer[i--]);
-      }
-      kfree(kbuffer);
+      res = -ENOMEM;
 
       goto module_cleanup;
-      return -EFAULT;
     }
+    RCU_INIT_POINTER(kbuffer[i], buffer);
   }
   kbuffer_allocated = true;
 
-  for (i = 0; i < devices_count; i++) {
+  for (i = 0; i < MAX_DEVICES_COUNT; i++) {
     mutex_init(&mutex_array[i]);
+    seqcount_init(&seq_array[i]);
+    mutex_init(&ring_array[i].write_lock);
+    mutex_init(&ring_array[i].read_lock);
+    init_waitqueue_head(&ring_array[i].write_queue);
+    init_waitqueue_head(&ring_array[i].read_queue);
   }
 
   if ((res = alloc_chrdev_region(&dev, 0, MAX_DEVICES_COUNT, DEVNAME)) < 0) {
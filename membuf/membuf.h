@@ -0,0 +1,19 @@
+#ifndef MEMBUF_H
+#define MEMBUF_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define MEMBUF_IOC_MAGIC 'm'
+
+// Current generation of the device. It is bumped by every write(2) and every
+// resize, and by MEMBUF_IOC_BUMP_GENERATION for data stored through mmap(2).
+#define MEMBUF_IOC_GET_GENERATION _IOR(MEMBUF_IOC_MAGIC, 1, __u64)
+
+// Publish data stored through mmap(2), returns the new generation.
+#define MEMBUF_IOC_BUMP_GENERATION _IOR(MEMBUF_IOC_MAGIC, 2, __u64)
+
+// Current size of the device buffer in bytes.
+#define MEMBUF_IOC_GET_SIZE _IOR(MEMBUF_IOC_MAGIC, 3, __u32)
+
+#endif
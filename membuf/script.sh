@@ -13,3 +13,44 @@ cat /sys/module/membuf/parameters/devices_count
 
 echo 8 > /sys/module/membuf/parameters/devices_count
 cat /sys/module/membuf/parameters/devices_count
+
+echo "2 1" > /sys/module/membuf/parameters/ring_mode_data
+cat /sys/module/membuf/parameters/ring_mode_data
+
+echo abc > /dev/membuf2
+echo def > /dev/membuf2
+test "$(dd if=/dev/membuf2 bs=8 count=1 iflag=nonblock status=none)" = "abc
+def"
+if dd if=/dev/membuf2 bs=8 count=1 iflag=nonblock status=none; then exit 1; fi
+
+# a blocking read sleeps until a writer comes
+dd if=/dev/membuf2 of=/tmp/membuf-ring bs=8 count=1 status=none &
+sleep 1
+kill -0 $!
+echo ghi > /dev/membuf2
+wait $!
+test "$(cat /tmp/membuf-ring)" = "ghi"
+rm /tmp/membuf-ring
+
+# a ring of size 0 takes no data, and wakes a reader shrinking it to 0
+dd if=/dev/membuf2 of=/dev/null bs=8 count=1 status=none &
+sleep 1
+echo "2 0" > /sys/module/membuf/parameters/buffer_size_data
+wait $!
+if echo jkl > /dev/membuf2; then exit 1; fi
+echo "2 256" > /sys/module/membuf/parameters/buffer_size_data
+
+echo "2 0" > /sys/module/membuf/parameters/ring_mode_data
+
+# resize while the device is open
+exec 3<> /dev/membuf0
+exec 4<> /dev/membuf5
+echo "0 512" > /sys/module/membuf/parameters/buffer_size_data
+test "$(head -c 3 /dev/membuf0)" = "123"
+if echo 4 > /sys/module/membuf/parameters/devices_count; then exit 1; fi
+exec 3>&- 4>&-
+echo 4 > /sys/module/membuf/parameters/devices_count
+
+# data stored through mmap is published with a generation bump
+make -s -C "$(dirname "$0")/user" mmap-test
+"$(dirname "$0")/user/mmap-test" /dev/membuf1
@@ -0,0 +1,84 @@
+// Check of data stored through mmap(2) of a membuf device.
+//
+// Maps the device, stores a pattern through the mapping, publishes it with
+// MEMBUF_IOC_BUMP_GENERATION and checks that read(2) returns the pattern and
+// that MEMBUF_IOC_GET_GENERATION reports the bumped generation. Exits with 0
+// if everything matches.
+//
+// Usage: mmap-test device
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "../membuf.h"
+
+static int fail(const char *what) {
+  perror(what);
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  __u64 before, bumped, after;
+  __u32 size, i;
+  char *map, *buf;
+  int fd;
+
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s device\n", argv[0]);
+    return 2;
+  }
+
+  fd = open(argv[1], O_RDWR);
+  if (fd < 0) {
+    return fail(argv[1]);
+  }
+  if (ioctl(fd, MEMBUF_IOC_GET_SIZE, &size) || ioctl(fd, MEMBUF_IOC_GET_GENERATION, &before)) {
+    return fail("ioctl");
+  }
+  if (size == 0) {
+    fprintf(stderr, "%s: empty buffer\n", argv[1]);
+    return 1;
+  }
+
+  map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  buf = malloc(size);
+  if (map == MAP_FAILED) {
+    return fail("mmap");
+  }
+  if (buf == NULL) {
+    return fail("malloc");
+  }
+
+  for (i = 0; i < size; i++) {
+    map[i] = 'a' + i % 26;
+  }
+
+  if (ioctl(fd, MEMBUF_IOC_BUMP_GENERATION, &bumped) || ioctl(fd, MEMBUF_IOC_GET_GENERATION, &after)) {
+    return fail("ioctl");
+  }
+  if (bumped != before + 1 || after != bumped) {
+    fprintf(stderr, "generation %llu, bumped to %llu, read back %llu\n", (unsigned long long) before,
+            (unsigned long long) bumped, (unsigned long long) after);
+    return 1;
+  }
+
+  if (pread(fd, buf, size, 0) != (ssize_t) size) {
+    return fail("read");
+  }
+  if (memcmp(buf, map, size) != 0) {
+    fprintf(stderr, "read(2) does not return the data stored through mmap(2)\n");
+    return 1;
+  }
+
+  munmap(map, size);
+  free(buf);
+  close(fd);
+
+  printf("mmap: %u bytes, generation %llu\n", size, (unsigned long long) after);
+  return 0;
+}
@@ -0,0 +1,186 @@
+// Concurrent readers of one membuf device.
+//
+// Every reader thread rereads the whole device buffer with pread() until
+// the time is up, optionally while one writer keeps rewriting it. The
+// aggregate read rate is printed for every reader count, one line each:
+//
+//   readers=8 writer=1 seconds=5.000 reads=41943040 reads_per_sec=8388608.0
+//
+// Usage: read-bench [-t seconds] [-w] device readers...
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "../membuf.h"
+
+struct worker {
+  pthread_t thread;
+  int fd;
+  size_t size;
+  unsigned long ops;
+  int err;
+};
+
+static atomic_bool stop;
+
+static void *reader_run(void *arg) {
+  struct worker *w = arg;
+  char *buf;
+  ssize_t ret;
+
+  buf = malloc(w->size);
+  if (buf == NULL) {
+    w->err = ENOMEM;
+    return NULL;
+  }
+
+  while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+    ret = pread(w->fd, buf, w->size, 0);
+    if (ret != (ssize_t) w->size) {
+      w->err = ret < 0 ? errno : EIO;
+      break;
+    }
+    w->ops++;
+  }
+
+  free(buf);
+  return NULL;
+}
+
+static void *writer_run(void *arg) {
+  struct worker *w = arg;
+  char *buf;
+  ssize_t ret;
+
+  buf = malloc(w->size);
+  if (buf == NULL) {
+    w->err = ENOMEM;
+    return NULL;
+  }
+
+  while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+    memset(buf, w->ops & 0xff, w->size);
+    ret = pwrite(w->fd, buf, w->size, 0);
+    if (ret != (ssize_t) w->size) {
+      w->err = ret < 0 ? errno : EIO;
+      break;
+    }
+    w->ops++;
+  }
+
+  free(buf);
+  return NULL;
+}
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int run(int fd, size_t size, int seconds, int writer, int nr_readers) {
+  struct worker *workers;
+  unsigned long reads = 0;
+  double start, elapsed;
+  int i, err = 0;
+  int nr_threads = nr_readers + writer;
+
+  workers = calloc(nr_threads, sizeof(*workers));
+  if (workers == NULL) {
+    return -1;
+  }
+
+  atomic_store(&stop, false);
+  start = now();
+  for (i = 0; i < nr_threads; i++) {
+    workers[i].fd = fd;
+    workers[i].size = size;
+    if (pthread_create(&workers[i].thread, NULL, i < nr_readers ? reader_run : writer_run, &workers[i])) {
+      perror("pthread_create");
+      exit(1);
+    }
+  }
+
+  sleep(seconds);
+  atomic_store(&stop, true);
+
+  for (i = 0; i < nr_threads; i++) {
+    pthread_join(workers[i].thread, NULL);
+    if (workers[i].err) {
+      err = workers[i].err;
+    }
+    if (i < nr_readers) {
+      reads += workers[i].ops;
+    }
+  }
+  elapsed = now() - start;
+
+  if (err) {
+    fprintf(stderr, "membuf: %s\n", strerror(err));
+  } else {
+    printf("readers=%d writer=%d seconds=%.3f reads=%lu reads_per_sec=%.1f\n", nr_readers, writer,
+           elapsed, reads, reads / elapsed);
+  }
+
+  free(workers);
+  return err ? -1 : 0;
+}
+
+int main(int argc, char **argv) {
+  int seconds = 5;
+  int writer = 0;
+  __u32 size;
+  int fd, i, opt, ret = 0;
+
+  while ((opt = getopt(argc, argv, "t:w")) != -1) {
+    switch (opt) {
+    case 't':
+      seconds = atoi(optarg);
+      break;
+    case 'w':
+      writer = 1;
+      break;
+    default:
+      goto usage;
+    }
+  }
+  if (optind + 2 > argc || seconds <= 0) {
+    goto usage;
+  }
+
+  fd = open(argv[optind], O_RDWR);
+  if (fd < 0 || ioctl(fd, MEMBUF_IOC_GET_SIZE, &size)) {
+    perror(argv[optind]);
+    return 1;
+  }
+  if (size == 0) {
+    fprintf(stderr, "%s: empty buffer\n", argv[optind]);
+    return 1;
+  }
+
+  for (i = optind + 1; i < argc; i++) {
+    if (atoi(argv[i]) <= 0) {
+      goto usage;
+    }
+    if (run(fd, size, seconds, writer, atoi(argv[i]))) {
+      ret = 1;
+    }
+  }
+
+  close(fd);
+  return ret;
+
+usage:
+  fprintf(stderr, "usage: %s [-t seconds] [-w] device readers...\n", argv[0]);
+  return 2;
+}
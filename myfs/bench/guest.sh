@@ -0,0 +1,76 @@
+#!/bin/sh
+#
+# /init of the benchmark guest started by run.sh. Runs every job of the
+# matrix on a fresh mount, prints its fio JSON between MYFS-BENCH-BEGIN and
+# MYFS-BENCH-END lines on the console and powers off.
+#
+
+/bin/busybox --install -s /bin
+
+mount -t proc proc /proc
+mount -t sysfs sysfs /sys
+mount -t devtmpfs devtmpfs /dev
+mount -t tmpfs tmpfs /tmp
+
+THREADS=$(echo "${THREADS:-1}" | tr , ' ')
+MODES=$(echo "${MODES:-memory}" | tr , ' ')
+RUNTIME=${RUNTIME:-10}
+SIZE=${SIZE:-256M}
+FILES=${FILES:-10000}
+
+insmod /myfs.ko || poweroff -f
+
+setup() {
+	case $1 in
+	memory)
+		mount -t myfs none /mnt/myfs
+		;;
+	disk)
+		mkfs-myfs /dev/vda > /dev/null && mount -t myfs_disk /dev/vda /mnt/myfs
+		;;
+	esac
+}
+
+# run one fio job on a fresh mount: run <mode> <tags> <fio options>
+run() {
+	mode=$1
+	tags=$2
+	shift 2
+
+	setup "$mode" || return
+	echo 3 > /proc/sys/vm/drop_caches
+	fio --output-format=json --output=/tmp/fio.json --directory=/mnt/myfs \
+		--percentile_list=50:90:99:99.9 --group_reporting "$@"
+	echo "MYFS-BENCH-BEGIN mode=$mode $tags"
+	cat /tmp/fio.json
+	echo "MYFS-BENCH-END"
+	rm -f /tmp/fio.json
+	umount /mnt/myfs
+}
+
+for mode in $MODES; do
+	for threads in $THREADS; do
+		for rw in read write randread randwrite; do
+			for bs in 4k 128k 1m; do
+				run $mode "job=$rw bs=$bs threads=$threads" --name=$rw \
+					--ioengine=psync --rw=$rw --bs=$bs --size=$SIZE \
+					--numjobs=$threads --fallocate=none \
+					--time_based --runtime=$RUNTIME --ramp_time=2
+			done
+		done
+
+		# the stat and unlink jobs lay out their files before timing
+		for op in create stat unlink; do
+			case $op in
+			create) engine=filecreate ;;
+			stat) engine=filestat ;;
+			unlink) engine=filedelete ;;
+			esac
+			run $mode "job=$op bs=- threads=$threads" --name=$op \
+				--ioengine=$engine --nrfiles=$FILES --filesize=4k \
+				--openfiles=1 --fallocate=none --numjobs=$threads
+		done
+	done
+done
+
+poweroff -f
@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+#
+# Turn the console log of a benchmark guest into results, one JSON object
+# per job:
+#
+#	{"version": ..., "mode": "memory", "job": "randread", "bs": "4k",
+#	 "threads": 4, "dir": "read", "bw_kib": ..., "iops": ...,
+#	 "lat_mean_us": ..., "lat_p50_us": ..., "lat_p90_us": ...,
+#	 "lat_p99_us": ..., "lat_p999_us": ...}
+#
+# Latencies are fio's completion latencies. The metadata jobs (create,
+# stat, unlink) count one I/O per file.
+#
+# Usage: report.py parse version < console.log > results.jsonl
+#        report.py compare old.jsonl new.jsonl
+#
+
+import json
+import sys
+
+PERCENTILES = (("50.000000", "lat_p50_us"), ("90.000000", "lat_p90_us"),
+               ("99.000000", "lat_p99_us"), ("99.900000", "lat_p999_us"))
+
+
+def result(version, tags, output):
+    job = json.loads(output)["jobs"][0]
+    direction = max(("read", "write"), key=lambda d: job[d]["total_ios"])
+    stats = job[direction]
+    clat = stats["clat_ns"]
+    percentile = clat.get("percentile", {})
+
+    res = {"version": version}
+    res.update(tags)
+    res["threads"] = int(res["threads"])
+    res["dir"] = direction
+    res["bw_kib"] = stats["bw"]
+    res["iops"] = round(stats["iops"], 1)
+    res["lat_mean_us"] = round(clat["mean"] / 1000, 1)
+    for key, name in PERCENTILES:
+        res[name] = round(percentile[key] / 1000, 1) if key in percentile else None
+
+    return res
+
+
+def parse(version):
+    tags, output = None, []
+
+    for line in sys.stdin:
+        if line.startswith("MYFS-BENCH-BEGIN "):
+            tags = dict(t.split("=", 1) for t in line.split()[1:])
+            output = []
+        elif line.startswith("MYFS-BENCH-END") and tags:
+            try:
+                print(json.dumps(result(version, tags, "".join(output))))
+            except (ValueError, KeyError, IndexError) as e:
+                print("bad output for %s: %s" % (tags, e), file=sys.stderr)
+            tags = None
+        elif tags:
+            output.append(line)
+
+
+def load(path):
+    with open(path) as f:
+        return {(r["mode"], r["job"], r["bs"], r["threads"]): r
+                for r in map(json.loads, f)}
+
+
+def change(old, new):
+    if not old or new is None:
+        return "     -"
+    return "%+5.1f%%" % ((new - old) * 100 / old)
+
+
+def compare(old_path, new_path):
+    old, new = load(old_path), load(new_path)
+
+    print("%-7s %-10s %-5s %3s %12s %7s %10s %7s" %
+          ("mode", "job", "bs", "thr", "iops", "", "p99 us", ""))
+    for key in sorted(old.keys() & new.keys()):
+        o, n = old[key], new[key]
+        print("%-7s %-10s %-5s %3d %12.1f %7s %10s %7s" %
+              (key + (n["iops"], change(o["iops"], n["iops"]),
+                      n["lat_p99_us"], change(o["lat_p99_us"], n["lat_p99_us"]))))
+
+
+def main():
+    if len(sys.argv) == 3 and sys.argv[1] == "parse":
+        parse(sys.argv[2])
+    elif len(sys.argv) == 4 and sys.argv[1] == "compare":
+        compare(sys.argv[2], sys.argv[3])
+    else:
+        print("Usage: %s parse version < console.log\n"
+              "       %s compare old.jsonl new.jsonl" % (sys.argv[0], sys.argv[0]),
+              file=sys.stderr)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,85 @@
+#!/bin/sh
+#
+# Boot the built myfs.ko in a QEMU guest, run the benchmark matrix of
+# guest.sh against it and write one JSON object per job to
+# results/<version>.jsonl, see report.py for the fields.
+#
+# The guest runs the kernel the module is built for with a throwaway
+# initramfs holding busybox, fio and their libraries, all taken from the
+# host. Settings come from the environment:
+#
+#	KERNEL		guest kernel, /boot/vmlinuz-$(cat KERNEL_VERSION)
+#	CPUS, MEM	guest size, 4 and 4G
+#	THREADS		thread counts, "1 2 4"
+#	MODES		"memory disk", the latter on a virtio disk of DISK_SIZE
+#	RUNTIME		seconds per I/O job, 10
+#	SIZE		file size per I/O thread, 256M
+#	FILES		files per thread for the metadata jobs, 10000
+#	VERSION		result name, git describe of the tree
+#
+# Compare two runs with: bench/report.py compare old.jsonl new.jsonl
+#
+
+set -e
+
+bench=$(cd "$(dirname "$0")" && pwd)
+top=$(dirname "$bench")
+
+KERNEL=${KERNEL:-/boot/vmlinuz-$(cat "$top/KERNEL_VERSION")}
+CPUS=${CPUS:-4}
+MEM=${MEM:-4G}
+THREADS=${THREADS:-"1 2 4"}
+MODES=${MODES:-"memory disk"}
+RUNTIME=${RUNTIME:-10}
+SIZE=${SIZE:-256M}
+FILES=${FILES:-10000}
+DISK_SIZE=${DISK_SIZE:-4G}
+VERSION=${VERSION:-$(git -C "$top" describe --always --dirty 2>/dev/null || date +%s)}
+
+for f in "$KERNEL" "$top/myfs.ko" "$top/user/mkfs-myfs"; do
+	if [ ! -e "$f" ]; then
+		echo "$f is missing, build the module and user/ first" >&2
+		exit 1
+	fi
+done
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+root=$work/root
+
+# copy a binary along with the shared libraries it needs
+install_bin() {
+	cp -L "$1" "$root/bin/"
+	ldd "$1" 2>/dev/null | grep -o '/[^ ]*' | while read -r lib; do
+		mkdir -p "$root$(dirname "$lib")"
+		cp -L "$lib" "$root$lib"
+	done
+}
+
+mkdir -p "$root/bin" "$root/proc" "$root/sys" "$root/dev" "$root/tmp" "$root/mnt/myfs"
+install_bin "$(command -v busybox)"
+install_bin "$(command -v fio)"
+install_bin "$top/user/mkfs-myfs"
+cp "$top/myfs.ko" "$root/"
+cp "$bench/guest.sh" "$root/init"
+chmod +x "$root/init"
+(cd "$root" && find . | cpio -o -H newc --quiet) | gzip > "$work/initrd.gz"
+
+truncate -s "$DISK_SIZE" "$work/disk.img"
+
+accel=
+if [ -w /dev/kvm ]; then
+	accel="-enable-kvm -cpu host"
+fi
+
+# the guest sees unknown key=value parameters as its environment
+qemu-system-x86_64 $accel -smp "$CPUS" -m "$MEM" \
+	-kernel "$KERNEL" -initrd "$work/initrd.gz" \
+	-drive file="$work/disk.img",format=raw,if=virtio,cache=none \
+	-nographic -no-reboot \
+	-append "console=ttyS0 quiet panic=-1 THREADS=$(echo $THREADS | tr ' ' ,) MODES=$(echo $MODES | tr ' ' ,) RUNTIME=$RUNTIME SIZE=$SIZE FILES=$FILES" \
+	| tr -d '\r' | tee "$work/console.log"
+
+mkdir -p "$bench/results"
+python3 "$bench/report.py" parse "$VERSION" < "$work/console.log" > "$bench/results/$VERSION.jsonl"
+echo "results in $bench/results/$VERSION.jsonl"
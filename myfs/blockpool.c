@@ -0,0 +1,296 @@
+/*
+ * Data block allocator.
+ *
+ * Every superblock owns a pool of blocks of its own block size. Blocks up
+ * to a page come from a dedicated slab cache; larger ones are order-N
+ * compound pages with a vmalloc fallback. In front of the backing allocator
+ * each CPU keeps a small magazine of free blocks, so the create/write/unlink
+ * churn mostly recycles blocks without touching the allocator at all, and
+ * misses are refilled in bulk.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/sched/mm.h>
+#include <linux/seq_file.h>
+
+#include "myfs.h"
+
+/* Upper bound on the bytes a single magazine may hold. */
+#define MYFS_MAGAZINE_BYTES	SZ_1M
+
+static void *myfs_backing_alloc(struct myfs_block_pool *pool)
+{
+	unsigned int nofs_flags;
+	struct page *page;
+	void *block;
+
+	nofs_flags = memalloc_nofs_save();
+	if (pool->cachep) {
+		block = kmem_cache_alloc(pool->cachep, GFP_KERNEL);
+	} else {
+		page = alloc_pages(GFP_KERNEL | __GFP_COMP | __GFP_NORETRY | __GFP_NOWARN,
+				   pool->order);
+		block = page ? page_address(page) : vmalloc(pool->blocksize);
+	}
+	memalloc_nofs_restore(nofs_flags);
+
+	if (block)
+		atomic_long_inc(&pool->nr_allocated);
+
+	return block;
+}
+
+static unsigned int myfs_backing_alloc_bulk(struct myfs_block_pool *pool,
+		void **blocks, unsigned int nr)
+{
+	unsigned int nofs_flags;
+	unsigned int i;
+
+	if (!pool->cachep) {
+		for (i = 0; i < nr; i++) {
+			blocks[i] = myfs_backing_alloc(pool);
+			if (!blocks[i])
+				break;
+		}
+		return i;
+	}
+
+	nofs_flags = memalloc_nofs_save();
+	i = kmem_cache_alloc_bulk(pool->cachep, GFP_KERNEL, nr, blocks);
+	memalloc_nofs_restore(nofs_flags);
+
+	atomic_long_add(i, &pool->nr_allocated);
+
+	return i;
+}
+
+static void myfs_backing_free_bulk(struct myfs_block_pool *pool,
+		void **blocks, unsigned int nr)
+{
+	unsigned int i;
+
+	if (!nr)
+		return;
+
+	if (pool->cachep) {
+		kmem_cache_free_bulk(pool->cachep, nr, blocks);
+	} else {
+		for (i = 0; i < nr; i++) {
+			if (is_vmalloc_addr(blocks[i]))
+				vfree(blocks[i]);
+			else
+				free_pages((unsigned long)blocks[i], pool->order);
+		}
+	}
+
+	atomic_long_sub(nr, &pool->nr_allocated);
+	this_cpu_add(pool->stats->drains, nr);
+}
+
+/*
+ * Put as many of @blocks as fit into this CPU's magazine and give the rest
+ * back to the backing allocator.
+ */
+static void myfs_mag_push(struct myfs_block_pool *pool, void **blocks, unsigned int nr)
+{
+	struct myfs_magazine *mag;
+	unsigned int pushed = 0;
+
+	local_lock(&pool->mags->lock);
+	mag = this_cpu_ptr(pool->mags);
+	while (pushed < nr && mag->nr < pool->capacity)
+		mag->blocks[mag->nr++] = blocks[pushed++];
+	local_unlock(&pool->mags->lock);
+
+	myfs_backing_free_bulk(pool, blocks + pushed, nr - pushed);
+}
+
+static void *myfs_pool_refill(struct myfs_block_pool *pool, unsigned int nr)
+{
+	void *batch[MYFS_MAGAZINE_SIZE];
+	unsigned int got;
+
+	got = myfs_backing_alloc_bulk(pool, batch, nr);
+	if (!got)
+		return NULL;
+
+	this_cpu_inc(pool->stats->refills);
+	this_cpu_add(pool->stats->refilled, got);
+
+	myfs_mag_push(pool, batch, got - 1);
+
+	return batch[got - 1];
+}
+
+/* Returns a zeroed block, or NULL when memory is exhausted. */
+void *myfs_pool_alloc(struct myfs_block_pool *pool)
+{
+	struct myfs_magazine *mag;
+	void *block = NULL;
+
+	local_lock(&pool->mags->lock);
+	mag = this_cpu_ptr(pool->mags);
+	if (mag->nr)
+		block = mag->blocks[--mag->nr];
+	local_unlock(&pool->mags->lock);
+
+	if (block)
+		this_cpu_inc(pool->stats->hits);
+	else
+		block = myfs_pool_refill(pool, max(pool->capacity / 2, 1U));
+
+	if (!block)
+		return NULL;
+
+	this_cpu_inc(pool->stats->allocs);
+	memset(block, 0, pool->blocksize);
+
+	return block;
+}
+
+void myfs_pool_free(struct myfs_block_pool *pool, void *block)
+{
+	void *spill[MYFS_MAGAZINE_SIZE];
+	struct myfs_magazine *mag;
+	unsigned int nr_spill = 0;
+
+	local_lock(&pool->mags->lock);
+	mag = this_cpu_ptr(pool->mags);
+	if (mag->nr == pool->capacity) {
+		/* Keep half of a full magazine, so alternating frees and allocs stay local. */
+		nr_spill = max(pool->capacity / 2, 1U);
+		mag->nr -= nr_spill;
+		memcpy(spill, mag->blocks + mag->nr, nr_spill * sizeof(void *));
+	}
+	mag->blocks[mag->nr++] = block;
+	local_unlock(&pool->mags->lock);
+
+	this_cpu_inc(pool->stats->frees);
+	myfs_backing_free_bulk(pool, spill, nr_spill);
+}
+
+/*
+ * Return blocks directly to the backing allocator, bypassing the magazines.
+ * Used when a whole mount goes away and the blocks will not be reused.
+ */
+void myfs_pool_release_bulk(struct myfs_block_pool *pool, void **blocks, unsigned int nr)
+{
+	this_cpu_add(pool->stats->frees, nr);
+	myfs_backing_free_bulk(pool, blocks, nr);
+}
+
+/*
+ * Top up this CPU's magazine ahead of a write that is about to allocate
+ * @nr blocks, so they are obtained in one bulk call instead of one by one.
+ */
+void myfs_pool_prefill(struct myfs_block_pool *pool, unsigned int nr)
+{
+	void *batch[MYFS_MAGAZINE_SIZE];
+	unsigned int room, got;
+
+	local_lock(&pool->mags->lock);
+	room = pool->capacity - this_cpu_ptr(pool->mags)->nr;
+	local_unlock(&pool->mags->lock);
+
+	nr = min(nr, room);
+	if (nr < 2)
+		return;
+
+	got = myfs_backing_alloc_bulk(pool, batch, nr);
+	if (!got)
+		return;
+
+	this_cpu_inc(pool->stats->refills);
+	this_cpu_add(pool->stats->refilled, got);
+
+	myfs_mag_push(pool, batch, got);
+}
+
+void myfs_pool_show(struct seq_file *m, struct myfs_block_pool *pool)
+{
+	struct myfs_pool_stats sum = {};
+	struct myfs_pool_stats *stats;
+	unsigned long pooled = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		stats = per_cpu_ptr(pool->stats, cpu);
+		sum.allocs += stats->allocs;
+		sum.frees += stats->frees;
+		sum.hits += stats->hits;
+		sum.refills += stats->refills;
+		sum.refilled += stats->refilled;
+		sum.drains += stats->drains;
+		pooled += READ_ONCE(per_cpu_ptr(pool->mags, cpu)->nr);
+	}
+
+	seq_printf(m, "blocksize:     %u\n", pool->blocksize);
+	seq_printf(m, "backend:       %s\n", pool->cachep ? "slab" : "pages");
+	seq_printf(m, "magazine_size: %u\n", pool->capacity);
+	seq_printf(m, "allocated:     %ld\n", atomic_long_read(&pool->nr_allocated));
+	seq_printf(m, "pooled:        %lu\n", pooled);
+	seq_printf(m, "allocs:        %llu\n", sum.allocs);
+	seq_printf(m, "frees:         %llu\n", sum.frees);
+	seq_printf(m, "hits:          %llu\n", sum.hits);
+	seq_printf(m, "refills:       %llu\n", sum.refills);
+	seq_printf(m, "refilled:      %llu\n", sum.refilled);
+	seq_printf(m, "drains:        %llu\n", sum.drains);
+}
+
+int myfs_pool_init(struct myfs_block_pool *pool, unsigned int blocksize, const char *name)
+{
+	int cpu;
+
+	pool->blocksize = blocksize;
+	pool->order = get_order(blocksize);
+	pool->capacity = clamp_t(unsigned int, MYFS_MAGAZINE_BYTES / blocksize,
+				 1, MYFS_MAGAZINE_SIZE);
+	atomic_long_set(&pool->nr_allocated, 0);
+
+	if (blocksize <= PAGE_SIZE) {
+		pool->cachep = kmem_cache_create(name, blocksize, blocksize, SLAB_ACCOUNT, NULL);
+		if (!pool->cachep)
+			return -ENOMEM;
+	}
+
+	pool->mags = alloc_percpu(struct myfs_magazine);
+	pool->stats = alloc_percpu(struct myfs_pool_stats);
+	if (!pool->mags || !pool->stats) {
+		free_percpu(pool->mags);
+		free_percpu(pool->stats);
+		kmem_cache_destroy(pool->cachep);
+		pool->mags = NULL;
+		pool->stats = NULL;
+		pool->cachep = NULL;
+		return -ENOMEM;
+	}
+
+	for_each_possible_cpu(cpu)
+		local_lock_init(&per_cpu_ptr(pool->mags, cpu)->lock);
+
+	return 0;
+}
+
+void myfs_pool_destroy(struct myfs_block_pool *pool)
+{
+	struct myfs_magazine *mag;
+	int cpu;
+
+	if (!pool->mags)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		mag = per_cpu_ptr(pool->mags, cpu);
+		myfs_backing_free_bulk(pool, mag->blocks, mag->nr);
+		mag->nr = 0;
+	}
+
+	WARN_ON(atomic_long_read(&pool->nr_allocated));
+
+	free_percpu(pool->mags);
+	free_percpu(pool->stats);
+	kmem_cache_destroy(pool->cachep);
+}
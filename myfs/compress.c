@@ -0,0 +1,251 @@
+/*
+ * Compression of cold blocks.
+ *
+ * With compress=<alg> a per-mount worker wakes up every compress_age
+ * seconds and walks the regular files of the mount. Each block access sets
+ * MYFS_MARK_REFERENCED in the block xarray; the worker clears the mark on
+ * referenced blocks and compresses the ones that were left alone since its
+ * previous pass. A compressed block replaces the plain one in the xarray as
+ * a tagged pointer and is decompressed back into a pool block on the next
+ * access.
+ *
+ * The worker swaps blocks under myfs_lock_blocks(), which keeps writers,
+ * read_folio and writepage off the inode, and leaves shared blocks alone.
+ * Readers that find a compressed entry race only with each other: the
+ * xa_cmpxchg decides whose copy is installed and the compressed buffer is
+ * freed after an RCU grace period, since a losing reader may still be
+ * decompressing from it.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/crypto.h>
+#include <linux/seq_file.h>
+
+#include "myfs.h"
+
+/* Blocks that do not shrink by at least an eighth are left alone. */
+static bool myfs_worth_compressing(struct myfs_sb_info *sbi, unsigned int len)
+{
+	return len <= sbi->blocksize - sbi->blocksize / 8;
+}
+
+static void myfs_compress_block(struct myfs_sb_info *sbi, struct myfs_inode_info *info,
+		unsigned long index, char *block)
+{
+	struct myfs_compressed *comp;
+	unsigned int len = sbi->blocksize;
+	void *old;
+
+	if (crypto_comp_compress(sbi->comp_tfm, block, sbi->blocksize, sbi->comp_buf, &len) ||
+	    !myfs_worth_compressing(sbi, len)) {
+		atomic_long_inc(&sbi->comp_stats.rejected);
+		return;
+	}
+
+	comp = kvmalloc(struct_size(comp, data, len), GFP_KERNEL | __GFP_NOWARN);
+	if (!comp)
+		return;
+	comp->len = len;
+	memcpy(comp->data, sbi->comp_buf, len);
+
+	old = xa_cmpxchg(&info->blocks, index, block,
+			 xa_tag_pointer(comp, MYFS_ENTRY_COMPRESSED), GFP_KERNEL);
+	if (old != block) {
+		kvfree(comp);
+		return;
+	}
+
+	myfs_pool_free(&sbi->pool, block);
+	atomic_long_inc(&sbi->comp_stats.nr_compressed);
+	atomic_long_add(len, &sbi->comp_stats.compressed_bytes);
+	atomic_long_inc(&sbi->comp_stats.compressions);
+}
+
+static void myfs_compress_inode(struct inode *inode, void *arg)
+{
+	struct myfs_sb_info *sbi = arg;
+	struct myfs_inode_info *info = MYFS_I(inode);
+	unsigned long index;
+	void *entry;
+
+	if (!myfs_lock_blocks(inode))
+		return;
+
+	xa_for_each(&info->blocks, index, entry) {
+		if (myfs_entry_offline(entry) ||
+		    xa_get_mark(&info->blocks, index, MYFS_MARK_SHARED))
+			continue;
+
+		if (xa_get_mark(&info->blocks, index, MYFS_MARK_REFERENCED))
+			xa_clear_mark(&info->blocks, index, MYFS_MARK_REFERENCED);
+		else
+			myfs_compress_block(sbi, info, index, entry);
+
+		cond_resched();
+	}
+
+	myfs_unlock_blocks(inode);
+}
+
+static void myfs_compress_work(struct work_struct *work)
+{
+	struct myfs_sb_info *sbi = container_of(to_delayed_work(work),
+						struct myfs_sb_info, comp_work);
+
+	myfs_for_each_inode(sbi, myfs_compress_inode, sbi);
+
+	queue_delayed_work(system_unbound_wq, &sbi->comp_work, sbi->comp_age * HZ);
+}
+
+static int myfs_decompress(struct myfs_sb_info *sbi, struct myfs_compressed *comp, char *dst)
+{
+	struct myfs_comp_stream *stream;
+	unsigned int len = sbi->blocksize;
+	int err;
+
+	local_lock(&sbi->comp_streams->lock);
+	stream = this_cpu_ptr(sbi->comp_streams);
+	err = crypto_comp_decompress(stream->tfm, comp->data, comp->len, dst, &len);
+	local_unlock(&sbi->comp_streams->lock);
+
+	if (!err && len != sbi->blocksize)
+		err = -EIO;
+
+	return err;
+}
+
+/*
+ * Replace the compressed block at @index with a decompressed copy. Returns
+ * whatever plain entry ends up there, which is NULL if the block was
+ * punched out in the meantime.
+ */
+char *myfs_decompress_block(struct inode *inode, unsigned long index)
+{
+	struct myfs_inode_info *info = MYFS_I(inode);
+	struct myfs_sb_info *sbi = MYFS_SB(inode->i_sb);
+	void *entry, *old;
+	char *block;
+	int err;
+
+	for (;;) {
+		block = myfs_pool_alloc(&sbi->pool);
+		if (!block)
+			return ERR_PTR(-ENOMEM);
+
+		rcu_read_lock();
+		entry = xa_load(&info->blocks, index);
+		if (!myfs_entry_compressed(entry)) {
+			rcu_read_unlock();
+			myfs_pool_free(&sbi->pool, block);
+			return entry;
+		}
+		err = myfs_decompress(sbi, xa_untag_pointer(entry), block);
+		rcu_read_unlock();
+
+		if (err) {
+			myfs_pool_free(&sbi->pool, block);
+			return ERR_PTR(err);
+		}
+
+		old = xa_cmpxchg(&info->blocks, index, entry, block, GFP_NOFS);
+		if (old == entry) {
+			myfs_free_compressed(sbi, entry);
+			atomic_long_inc(&sbi->comp_stats.decompressions);
+			return block;
+		}
+
+		myfs_pool_free(&sbi->pool, block);
+		if (xa_is_err(old))
+			return ERR_PTR(xa_err(old));
+		if (!myfs_entry_compressed(old))
+			return old;
+	}
+}
+
+void myfs_free_compressed(struct myfs_sb_info *sbi, void *entry)
+{
+	struct myfs_compressed *comp = xa_untag_pointer(entry);
+
+	atomic_long_dec(&sbi->comp_stats.nr_compressed);
+	atomic_long_sub(comp->len, &sbi->comp_stats.compressed_bytes);
+	kvfree_rcu(comp, rcu);
+}
+
+void myfs_compress_show(struct seq_file *m, struct myfs_sb_info *sbi)
+{
+	struct myfs_comp_stats *stats = &sbi->comp_stats;
+	long nr = atomic_long_read(&stats->nr_compressed);
+
+	seq_printf(m, "algorithm:          %s\n", sbi->comp_alg ?: "none");
+	seq_printf(m, "age:                %u\n", sbi->comp_age);
+	seq_printf(m, "compressed_blocks:  %ld\n", nr);
+	seq_printf(m, "uncompressed_bytes: %llu\n", (u64)nr << sbi->blocksize_bits);
+	seq_printf(m, "compressed_bytes:   %ld\n", atomic_long_read(&stats->compressed_bytes));
+	seq_printf(m, "compressions:       %ld\n", atomic_long_read(&stats->compressions));
+	seq_printf(m, "decompressions:     %ld\n", atomic_long_read(&stats->decompressions));
+	seq_printf(m, "rejected:           %ld\n", atomic_long_read(&stats->rejected));
+}
+
+int myfs_compress_init(struct myfs_sb_info *sbi)
+{
+	struct myfs_comp_stream *stream;
+	int cpu;
+
+	if (!sbi->comp_alg)
+		return 0;
+
+	INIT_DELAYED_WORK(&sbi->comp_work, myfs_compress_work);
+
+	sbi->comp_tfm = crypto_alloc_comp(sbi->comp_alg, 0, 0);
+	if (IS_ERR(sbi->comp_tfm)) {
+		pr_err("myfs: compression algorithm '%s' is not available\n", sbi->comp_alg);
+		sbi->comp_tfm = NULL;
+		return -EINVAL;
+	}
+
+	sbi->comp_buf = kvmalloc(sbi->blocksize, GFP_KERNEL);
+	sbi->comp_streams = alloc_percpu(struct myfs_comp_stream);
+	if (!sbi->comp_buf || !sbi->comp_streams)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		stream = per_cpu_ptr(sbi->comp_streams, cpu);
+		local_lock_init(&stream->lock);
+		stream->tfm = crypto_alloc_comp(sbi->comp_alg, 0, 0);
+		if (IS_ERR(stream->tfm)) {
+			stream->tfm = NULL;
+			return -ENOMEM;
+		}
+	}
+
+	queue_delayed_work(system_unbound_wq, &sbi->comp_work, sbi->comp_age * HZ);
+
+	return 0;
+}
+
+/*
+ * Stops the worker and frees the transforms. Compressed blocks left in the
+ * xarrays are freed with the rest of the storage.
+ */
+void myfs_compress_exit(struct myfs_sb_info *sbi)
+{
+	int cpu;
+
+	if (sbi->comp_tfm)
+		cancel_delayed_work_sync(&sbi->comp_work);
+
+	if (sbi->comp_streams) {
+		for_each_possible_cpu(cpu)
+			crypto_free_comp(per_cpu_ptr(sbi->comp_streams, cpu)->tfm);
+		free_percpu(sbi->comp_streams);
+		sbi->comp_streams = NULL;
+	}
+
+	kvfree(sbi->comp_buf);
+	sbi->comp_buf = NULL;
+	crypto_free_comp(sbi->comp_tfm);
+	sbi->comp_tfm = NULL;
+}
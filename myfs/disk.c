@@ -0,0 +1,1437 @@
+/*
+ * myfs_disk: myfs on a block device.
+ *
+ * The same filesystem, mounted with mount_bdev on a device formatted by
+ * user/mkfs-myfs; myfs_disk.h describes the layout. File data lives in
+ * extents on the device and goes through the page cache with the generic
+ * buffer_head helpers, so reads, writeback, mmap and O_DIRECT are plain
+ * block I/O. The bitmaps, the inode table, extent blocks and directory
+ * blocks are metadata in the buffer cache of the device.
+ *
+ * The namespace works as in the memory-backed mode, with the directory
+ * operations of super.c: the whole tree is read in at mount and stays
+ * pinned in the dcache. sync_fs writes the directories and inodes back
+ * from the tree, dirtying only the buffers whose contents changed, and
+ * kill_sb syncs before the tree is torn down. fsync of a directory writes
+ * just that directory and its children.
+ *
+ * An inode number freed at evict stays taken in the bitmap until a tree
+ * walk has put the directories without its name on disk, so a stale entry
+ * never points at a free or reused inode after a crash.
+ *
+ * A block is allocated when a page is first written, as close as possible
+ * after the block before it in the file. New files start in different 8M
+ * areas of the device, so files written side by side do not interleave
+ * and sequential writes end up in few extents. A file can have up to
+ * MYFS_DISK_MAX_EXTENTS of them.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/buffer_head.h>
+#include <linux/mpage.h>
+#include <linux/pagemap.h>
+#include <linux/writeback.h>
+#include <linux/statfs.h>
+#include <linux/dcache.h>
+#include <linux/string.h>
+
+#include "myfs.h"
+#include "myfs_disk.h"
+
+#define MYFS_DISK_BITS			(MYFS_DISK_BLOCKSIZE * 8)
+#define MYFS_DISK_INODES_PER_BLOCK	(MYFS_DISK_BLOCKSIZE / MYFS_DISK_INODE_SIZE)
+
+/* blocks per area new files are spread over */
+#define MYFS_DISK_AREA			(SZ_8M / MYFS_DISK_BLOCKSIZE)
+
+struct myfs_disk {
+	unsigned int nr_blocks;
+	unsigned int nr_inodes;
+	unsigned int inode_table;
+	unsigned int data_start;
+
+	/* both bitmaps stay in memory for the life of the mount */
+	spinlock_t lock;		/* bitmaps and free counts */
+	struct buffer_head **imap;
+	struct buffer_head **bmap;
+	unsigned int nr_imap;
+	unsigned int nr_bmap;
+	unsigned long free_inodes;
+	unsigned long free_blocks;
+	unsigned long *ifree;		/* inodes evicted since the last tree walk */
+	unsigned long nr_ifree;
+
+	struct mutex sync_lock;		/* one tree walk at a time */
+	unsigned long *ifree_sync;	/* the ones the running walk releases */
+};
+
+struct myfs_extent {
+	u32 lblk;
+	u32 pblk;
+	u32 len;
+};
+
+/* The extents of an inode, sorted by lblk. */
+struct myfs_extent_map {
+	struct mutex lock;
+	struct myfs_extent *ext;
+	unsigned int nr;
+	unsigned int max;
+	u32 extent_block;	/* where the extents past MYFS_DISK_EXTENTS are stored */
+};
+
+static const struct address_space_operations myfs_disk_aops;
+static const struct file_operations myfs_disk_file_operations;
+static const struct inode_operations myfs_disk_file_inode_operations;
+
+static struct myfs_disk *MYFS_DISK(struct super_block *sb)
+{
+	return MYFS_SB(sb)->disk;
+}
+
+/*
+ * Bitmaps.
+ */
+
+/* Find a clear bit from @goal on, wrapping around, and set it. */
+static long myfs_disk_bitmap_alloc(struct buffer_head **map, unsigned long nbits,
+		unsigned long goal)
+{
+	unsigned long start = goal < nbits ? goal : 0, end = nbits;
+	unsigned long bit, off, lim;
+	unsigned int i;
+	int pass;
+
+	for (pass = 0; pass < 2; pass++) {
+		for (bit = start; bit < end; bit = (unsigned long)(i + 1) * MYFS_DISK_BITS) {
+			i = bit / MYFS_DISK_BITS;
+			lim = min_t(unsigned long, MYFS_DISK_BITS, end - (unsigned long)i * MYFS_DISK_BITS);
+			off = find_next_zero_bit_le(map[i]->b_data, lim, bit % MYFS_DISK_BITS);
+			if (off < lim) {
+				__set_bit_le(off, map[i]->b_data);
+				mark_buffer_dirty(map[i]);
+				return (unsigned long)i * MYFS_DISK_BITS + off;
+			}
+		}
+		end = start;
+		start = 0;
+	}
+
+	return -ENOSPC;
+}
+
+static void myfs_disk_bitmap_free(struct buffer_head **map, unsigned long bit)
+{
+	struct buffer_head *bh = map[bit / MYFS_DISK_BITS];
+
+	WARN_ON_ONCE(!__test_and_clear_bit_le(bit % MYFS_DISK_BITS, bh->b_data));
+	mark_buffer_dirty(bh);
+}
+
+static long myfs_disk_alloc_block(struct myfs_disk *disk, unsigned long goal)
+{
+	long blk;
+
+	spin_lock(&disk->lock);
+	blk = myfs_disk_bitmap_alloc(disk->bmap, disk->nr_blocks, goal);
+	if (blk >= 0)
+		disk->free_blocks--;
+	spin_unlock(&disk->lock);
+
+	return blk;
+}
+
+static void myfs_disk_free_blocks(struct myfs_disk *disk, u32 blk, u32 len)
+{
+	u32 i;
+
+	if (WARN_ON_ONCE(blk < disk->data_start || (u64)blk + len > disk->nr_blocks))
+		return;
+
+	spin_lock(&disk->lock);
+	for (i = 0; i < len; i++)
+		myfs_disk_bitmap_free(disk->bmap, blk + i);
+	disk->free_blocks += len;
+	spin_unlock(&disk->lock);
+}
+
+/* Metadata blocks may have dirty buffers that must not land on their next user. */
+static void myfs_disk_free_meta(struct super_block *sb, u32 blk, u32 len)
+{
+	clean_bdev_aliases(sb->s_bdev, blk, len);
+	myfs_disk_free_blocks(MYFS_DISK(sb), blk, len);
+}
+
+/*
+ * Extents.
+ */
+
+/* Index of the last extent that starts at or before @lblk, or -1. */
+static int myfs_extent_find(struct myfs_extent_map *map, u32 lblk)
+{
+	int lo = 0, hi = (int)map->nr - 1, mid, found = -1;
+
+	while (lo <= hi) {
+		mid = lo + (hi - lo) / 2;
+		if (map->ext[mid].lblk <= lblk) {
+			found = mid;
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+
+	return found;
+}
+
+static int myfs_extent_insert(struct myfs_extent_map *map, unsigned int pos,
+		u32 lblk, u32 pblk)
+{
+	struct myfs_extent *ext;
+	unsigned int max;
+
+	if (map->nr == map->max) {
+		if (map->max >= MYFS_DISK_MAX_EXTENTS)
+			return -ENOSPC;
+		max = min_t(unsigned int, max(map->max * 2, MYFS_DISK_EXTENTS),
+			    MYFS_DISK_MAX_EXTENTS);
+		ext = krealloc_array(map->ext, max, sizeof(*ext), GFP_NOFS);
+		if (!ext)
+			return -ENOMEM;
+		map->ext = ext;
+		map->max = max;
+	}
+
+	memmove(&map->ext[pos + 1], &map->ext[pos], (map->nr - pos) * sizeof(*map->ext));
+	map->ext[pos] = (struct myfs_extent){ .lblk = lblk, .pblk = pblk, .len = 1 };
+	map->nr++;
+
+	return 0;
+}
+
+/* Merge extent @i with the one after it if the two are contiguous. */
+static void myfs_extent_merge(struct myfs_extent_map *map, unsigned int i)
+{
+	struct myfs_extent *e = &map->ext[i], *next = e + 1;
+
+	if (i + 1 >= map->nr || (u64)e->len + next->len > U32_MAX ||
+	    e->lblk + e->len != next->lblk || e->pblk + e->len != next->pblk)
+		return;
+
+	e->len += next->len;
+	memmove(next, next + 1, (map->nr - i - 2) * sizeof(*map->ext));
+	map->nr--;
+}
+
+/* Where the first block of a file should go. */
+static unsigned long myfs_disk_goal(struct inode *inode)
+{
+	struct myfs_disk *disk = MYFS_DISK(inode->i_sb);
+	unsigned long areas = max(1U, (disk->nr_blocks - disk->data_start) / MYFS_DISK_AREA);
+
+	return disk->data_start + (inode->i_ino % areas) * MYFS_DISK_AREA;
+}
+
+/*
+ * Map block @lblk of @inode, allocating it for a hole if @new is given,
+ * which is then set if a block was allocated. Returns the device block,
+ * with the number of blocks mapped contiguously from there in @count, or
+ * 0 for a hole. Called with the map locked.
+ */
+static long myfs_disk_map(struct inode *inode, u32 lblk, u32 *count, bool *new)
+{
+	struct myfs_extent_map *map = MYFS_I(inode)->extents;
+	struct myfs_extent *e = NULL;
+	unsigned long goal;
+	long pblk;
+	int i, err;
+
+	i = myfs_extent_find(map, lblk);
+	if (i >= 0) {
+		e = &map->ext[i];
+		if (lblk - e->lblk < e->len) {
+			*count = e->len - (lblk - e->lblk);
+			return e->pblk + (lblk - e->lblk);
+		}
+	}
+	if (!new)
+		return 0;
+
+	/* keep the distance to the previous extent, as a later fill may close it */
+	goal = e ? e->pblk + (unsigned long)(lblk - e->lblk) : myfs_disk_goal(inode);
+	pblk = myfs_disk_alloc_block(MYFS_DISK(inode->i_sb), goal);
+	if (pblk < 0)
+		return pblk;
+
+	if (e && e->lblk + e->len == lblk && e->pblk + e->len == pblk && e->len < U32_MAX) {
+		e->len++;
+	} else {
+		i++;
+		err = myfs_extent_insert(map, i, lblk, pblk);
+		if (err) {
+			myfs_disk_free_blocks(MYFS_DISK(inode->i_sb), pblk, 1);
+			return err;
+		}
+	}
+	myfs_extent_merge(map, i);
+	inode_add_bytes(inode, MYFS_DISK_BLOCKSIZE);
+
+	*new = true;
+	*count = 1;
+	return pblk;
+}
+
+/* Free the blocks from @size on. The caller marks the inode dirty. */
+static void myfs_disk_truncate_blocks(struct inode *inode, loff_t size)
+{
+	struct myfs_extent_map *map = MYFS_I(inode)->extents;
+	u64 first = ((u64)size + MYFS_DISK_BLOCKSIZE - 1) >> inode->i_blkbits;
+	struct myfs_extent *e;
+	u32 keep;
+	int i;
+
+	mutex_lock(&map->lock);
+	for (i = (int)map->nr - 1; i >= 0; i--) {
+		e = &map->ext[i];
+		if ((u64)e->lblk + e->len <= first)
+			break;
+
+		keep = first > e->lblk ? first - e->lblk : 0;
+		if (S_ISDIR(inode->i_mode))
+			myfs_disk_free_meta(inode->i_sb, e->pblk + keep, e->len - keep);
+		else
+			myfs_disk_free_blocks(MYFS_DISK(inode->i_sb), e->pblk + keep, e->len - keep);
+		inode_sub_bytes(inode, (loff_t)(e->len - keep) * MYFS_DISK_BLOCKSIZE);
+
+		e->len = keep;
+		if (!keep)
+			map->nr = i;
+	}
+	mutex_unlock(&map->lock);
+}
+
+static struct myfs_extent_map *myfs_extent_map_alloc(void)
+{
+	struct myfs_extent_map *map;
+
+	map = kzalloc(sizeof(*map), GFP_NOFS);
+	if (map)
+		mutex_init(&map->lock);
+
+	return map;
+}
+
+static void myfs_extent_map_free(struct myfs_extent_map *map)
+{
+	if (map)
+		kfree(map->ext);
+	kfree(map);
+}
+
+static void myfs_extent_pack(struct myfs_disk_extent *de, const struct myfs_extent *e)
+{
+	de->lblk = cpu_to_le32(e->lblk);
+	de->pblk = cpu_to_le32(e->pblk);
+	de->len = cpu_to_le32(e->len);
+}
+
+static int myfs_extent_unpack(struct myfs_disk *disk, struct myfs_extent *e,
+		const struct myfs_disk_extent *de, const struct myfs_extent *prev)
+{
+	e->lblk = le32_to_cpu(de->lblk);
+	e->pblk = le32_to_cpu(de->pblk);
+	e->len = le32_to_cpu(de->len);
+
+	if (!e->len || e->pblk < disk->data_start || (u64)e->pblk + e->len > disk->nr_blocks ||
+	    (u64)e->lblk + e->len > (u64)U32_MAX + 1 ||
+	    (prev && (u64)prev->lblk + prev->len > e->lblk))
+		return -EUCLEAN;
+
+	return 0;
+}
+
+/*
+ * Inodes.
+ */
+
+static struct buffer_head *myfs_disk_inode_bh(struct super_block *sb, unsigned long ino,
+		struct myfs_disk_inode **raw)
+{
+	struct myfs_disk *disk = MYFS_DISK(sb);
+	struct buffer_head *bh;
+
+	bh = sb_bread(sb, disk->inode_table + ino / MYFS_DISK_INODES_PER_BLOCK);
+	if (bh)
+		*raw = (void *)bh->b_data + (ino % MYFS_DISK_INODES_PER_BLOCK) * MYFS_DISK_INODE_SIZE;
+
+	return bh;
+}
+
+static int myfs_disk_load_extents(struct inode *inode, const struct myfs_disk_inode *raw)
+{
+	struct myfs_disk *disk = MYFS_DISK(inode->i_sb);
+	struct myfs_extent_map *map = MYFS_I(inode)->extents;
+	const struct myfs_disk_extent *de;
+	unsigned int nr = le32_to_cpu(raw->nr_extents), i;
+	struct buffer_head *bh = NULL;
+	u64 blocks = 0;
+	int err = 0;
+
+	if (nr > MYFS_DISK_MAX_EXTENTS)
+		return -EUCLEAN;
+	if (!nr)
+		return 0;
+
+	map->max = max_t(unsigned int, nr, MYFS_DISK_EXTENTS);
+	map->ext = kcalloc(map->max, sizeof(*map->ext), GFP_NOFS);
+	if (!map->ext)
+		return -ENOMEM;
+
+	if (nr > MYFS_DISK_EXTENTS) {
+		map->extent_block = le32_to_cpu(raw->extent_block);
+		if (map->extent_block < disk->data_start || map->extent_block >= disk->nr_blocks)
+			return -EUCLEAN;
+		bh = sb_bread(inode->i_sb, map->extent_block);
+		if (!bh)
+			return -EIO;
+		blocks++;
+	}
+
+	for (i = 0; i < nr; i++) {
+		de = i < MYFS_DISK_EXTENTS ? &raw->extents[i] :
+		     (struct myfs_disk_extent *)bh->b_data + (i - MYFS_DISK_EXTENTS);
+		err = myfs_extent_unpack(disk, &map->ext[i], de, i ? &map->ext[i - 1] : NULL);
+		if (err)
+			break;
+		blocks += map->ext[i].len;
+	}
+	brelse(bh);
+	if (err)
+		return err;
+
+	map->nr = nr;
+	inode_set_bytes(inode, blocks * MYFS_DISK_BLOCKSIZE);
+
+	return 0;
+}
+
+static int myfs_disk_read_inode(struct inode *inode)
+{
+	struct super_block *sb = inode->i_sb;
+	struct myfs_disk *disk = MYFS_DISK(sb);
+	struct myfs_disk_inode *raw;
+	struct buffer_head *bh;
+	int err;
+
+	if (inode->i_ino >= disk->nr_inodes ||
+	    !test_bit_le(inode->i_ino % MYFS_DISK_BITS, disk->imap[inode->i_ino / MYFS_DISK_BITS]->b_data))
+		return -EUCLEAN;
+
+	MYFS_I(inode)->extents = myfs_extent_map_alloc();
+	if (!MYFS_I(inode)->extents)
+		return -ENOMEM;
+
+	bh = myfs_disk_inode_bh(sb, inode->i_ino, &raw);
+	if (!bh)
+		return -EIO;
+
+	inode->i_mode = le16_to_cpu(raw->mode);
+	i_uid_write(inode, le32_to_cpu(raw->uid));
+	i_gid_write(inode, le32_to_cpu(raw->gid));
+	set_nlink(inode, le16_to_cpu(raw->nlink));
+	i_size_write(inode, le64_to_cpu(raw->size));
+	inode->i_atime.tv_sec = le64_to_cpu(raw->atime);
+	inode->i_mtime.tv_sec = le64_to_cpu(raw->mtime);
+	inode->i_ctime.tv_sec = le64_to_cpu(raw->ctime);
+	inode->i_atime.tv_nsec = le32_to_cpu(raw->atime_nsec);
+	inode->i_mtime.tv_nsec = le32_to_cpu(raw->mtime_nsec);
+	inode->i_ctime.tv_nsec = le32_to_cpu(raw->ctime_nsec);
+	err = myfs_disk_load_extents(inode, raw);
+	brelse(bh);
+	if (err)
+		return err;
+
+	if (!inode->i_nlink || i_size_read(inode) < 0 || fs_umode_to_dtype(inode->i_mode) == DT_UNKNOWN)
+		return -EUCLEAN;
+
+	inode->i_mapping->a_ops = &myfs_disk_aops;
+	if (S_ISDIR(inode->i_mode)) {
+		inode->i_op = &myfs_dir_inode_operations;
+		inode->i_fop = &myfs_dir_operations;
+	} else if (S_ISREG(inode->i_mode)) {
+		inode->i_op = &myfs_disk_file_inode_operations;
+		inode->i_fop = &myfs_disk_file_operations;
+	}
+
+	return 0;
+}
+
+static struct inode *myfs_disk_iget(struct super_block *sb, unsigned long ino)
+{
+	struct inode *inode;
+	int err;
+
+	inode = iget_locked(sb, ino);
+	if (!inode)
+		return ERR_PTR(-ENOMEM);
+	if (!(inode->i_state & I_NEW))
+		return inode;
+
+	percpu_counter_inc(&MYFS_SB(sb)->used_inodes);
+	err = myfs_disk_read_inode(inode);
+	if (err) {
+		iget_failed(inode);
+		return ERR_PTR(err);
+	}
+	unlock_new_inode(inode);
+
+	return inode;
+}
+
+/*
+ * Called by myfs_get_inode() for a new inode of a myfs_disk mount, after
+ * the parts it shares with the memory-backed mode are set up.
+ */
+int myfs_disk_new_inode(struct inode *inode)
+{
+	struct myfs_disk *disk = MYFS_DISK(inode->i_sb);
+	long ino;
+
+	/* nothing to give back on disk until the number is allocated */
+	inode->i_ino = 0;
+
+	MYFS_I(inode)->extents = myfs_extent_map_alloc();
+	if (!MYFS_I(inode)->extents)
+		return -ENOMEM;
+
+	spin_lock(&disk->lock);
+	ino = myfs_disk_bitmap_alloc(disk->imap, disk->nr_inodes, MYFS_DISK_ROOT_INO);
+	if (ino >= 0)
+		disk->free_inodes--;
+	spin_unlock(&disk->lock);
+	if (ino < 0)
+		return ino;
+
+	inode->i_ino = ino;
+	inode->i_mapping->a_ops = &myfs_disk_aops;
+	if (S_ISREG(inode->i_mode)) {
+		inode->i_op = &myfs_disk_file_inode_operations;
+		inode->i_fop = &myfs_disk_file_operations;
+	}
+	insert_inode_hash(inode);
+	mark_inode_dirty(inode);
+
+	return 0;
+}
+
+/* Extents past the ones that fit in the inode go to the extent block. */
+static int myfs_disk_store_extents(struct inode *inode, struct myfs_disk_inode *raw, bool sync)
+{
+	struct super_block *sb = inode->i_sb;
+	struct myfs_extent_map *map = MYFS_I(inode)->extents;
+	struct myfs_disk_extent *de, e;
+	struct buffer_head *bh;
+	bool changed;
+	unsigned int i;
+	long blk;
+	int err = 0;
+
+	for (i = 0; i < map->nr && i < MYFS_DISK_EXTENTS; i++)
+		myfs_extent_pack(&raw->extents[i], &map->ext[i]);
+	raw->nr_extents = cpu_to_le32(map->nr);
+
+	if (map->nr <= MYFS_DISK_EXTENTS) {
+		if (map->extent_block) {
+			myfs_disk_free_meta(sb, map->extent_block, 1);
+			inode_sub_bytes(inode, MYFS_DISK_BLOCKSIZE);
+			map->extent_block = 0;
+		}
+		return 0;
+	}
+
+	if (!map->extent_block) {
+		blk = myfs_disk_alloc_block(MYFS_DISK(sb), map->ext[0].pblk);
+		if (blk < 0)
+			return blk;
+		map->extent_block = blk;
+		inode_add_bytes(inode, MYFS_DISK_BLOCKSIZE);
+	}
+	raw->extent_block = cpu_to_le32(map->extent_block);
+
+	bh = sb_getblk(sb, map->extent_block);
+	if (!bh)
+		return -ENOMEM;
+
+	lock_buffer(bh);
+	changed = !buffer_uptodate(bh);
+	if (changed)
+		memset(bh->b_data, 0, MYFS_DISK_BLOCKSIZE);
+	de = (void *)bh->b_data;
+	for (i = MYFS_DISK_EXTENTS; i < map->nr; i++) {
+		myfs_extent_pack(&e, &map->ext[i]);
+		if (memcmp(&de[i - MYFS_DISK_EXTENTS], &e, sizeof(e))) {
+			de[i - MYFS_DISK_EXTENTS] = e;
+			changed = true;
+		}
+	}
+	set_buffer_uptodate(bh);
+	unlock_buffer(bh);
+
+	if (changed)
+		mark_buffer_dirty(bh);
+	if (sync)
+		err = sync_dirty_buffer(bh);
+	brelse(bh);
+
+	return err;
+}
+
+static int myfs_disk_store_inode(struct inode *inode, bool sync)
+{
+	struct myfs_extent_map *map = MYFS_I(inode)->extents;
+	struct myfs_disk_inode new = {
+		.mode		= cpu_to_le16(inode->i_mode),
+		.nlink		= cpu_to_le16(inode->i_nlink),
+		.uid		= cpu_to_le32(i_uid_read(inode)),
+		.gid		= cpu_to_le32(i_gid_read(inode)),
+		.size		= cpu_to_le64(i_size_read(inode)),
+		.atime		= cpu_to_le64(inode->i_atime.tv_sec),
+		.mtime		= cpu_to_le64(inode->i_mtime.tv_sec),
+		.ctime		= cpu_to_le64(inode->i_ctime.tv_sec),
+		.atime_nsec	= cpu_to_le32(inode->i_atime.tv_nsec),
+		.mtime_nsec	= cpu_to_le32(inode->i_mtime.tv_nsec),
+		.ctime_nsec	= cpu_to_le32(inode->i_ctime.tv_nsec),
+	};
+	struct myfs_disk_inode *raw;
+	struct buffer_head *bh;
+	int err;
+
+	mutex_lock(&map->lock);
+	err = myfs_disk_store_extents(inode, &new, sync);
+	mutex_unlock(&map->lock);
+	if (err)
+		return err;
+
+	bh = myfs_disk_inode_bh(inode->i_sb, inode->i_ino, &raw);
+	if (!bh)
+		return -EIO;
+
+	lock_buffer(bh);
+	if (memcmp(raw, &new, sizeof(new))) {
+		memcpy(raw, &new, sizeof(new));
+		unlock_buffer(bh);
+		mark_buffer_dirty(bh);
+	} else {
+		unlock_buffer(bh);
+	}
+	if (sync)
+		err = sync_dirty_buffer(bh);
+	brelse(bh);
+
+	return err;
+}
+
+static int myfs_disk_write_inode(struct inode *inode, struct writeback_control *wbc)
+{
+	return myfs_disk_store_inode(inode, wbc->sync_mode == WB_SYNC_ALL);
+}
+
+static void myfs_disk_evict_inode(struct inode *inode)
+{
+	struct myfs_inode_info *info = MYFS_I(inode);
+	struct myfs_disk *disk = MYFS_DISK(inode->i_sb);
+	bool release = !inode->i_nlink && inode->i_ino && !is_bad_inode(inode);
+
+	truncate_inode_pages_final(&inode->i_data);
+	if (release && info->extents) {
+		myfs_disk_truncate_blocks(inode, 0);
+		if (info->extents->extent_block)
+			myfs_disk_free_meta(inode->i_sb, info->extents->extent_block, 1);
+	}
+	invalidate_inode_buffers(inode);
+	clear_inode(inode);
+
+	/* the number is given back by the next tree walk */
+	if (release) {
+		spin_lock(&disk->lock);
+		__set_bit(inode->i_ino, disk->ifree);
+		disk->nr_ifree++;
+		spin_unlock(&disk->lock);
+	}
+
+	myfs_extent_map_free(info->extents);
+	info->extents = NULL;
+	percpu_counter_dec(&MYFS_SB(inode->i_sb)->used_inodes);
+}
+
+
+/*
+ * File data.
+ */
+
+static int myfs_disk_get_block(struct inode *inode, sector_t iblock,
+		struct buffer_head *bh_result, int create)
+{
+	struct myfs_extent_map *map = MYFS_I(inode)->extents;
+	u64 max = bh_result->b_size >> inode->i_blkbits;
+	bool new = false;
+	u32 count;
+	long pblk;
+
+	if (iblock > U32_MAX)
+		return create ? -EFBIG : 0;
+
+	mutex_lock(&map->lock);
+	pblk = myfs_disk_map(inode, iblock, &count, create ? &new : NULL);
+	mutex_unlock(&map->lock);
+	if (pblk <= 0)
+		return pblk;
+
+	map_bh(bh_result, inode->i_sb, pblk);
+	bh_result->b_size = min_t(u64, count, max ?: 1) << inode->i_blkbits;
+	if (new) {
+		set_buffer_new(bh_result);
+		mark_inode_dirty(inode);
+	}
+
+	return 0;
+}
+
+/* Blocks allocated past EOF by a write that did not make it go. */
+static void myfs_disk_write_failed(struct address_space *mapping, loff_t to)
+{
+	struct inode *inode = mapping->host;
+
+	if (to > inode->i_size) {
+		truncate_pagecache(inode, inode->i_size);
+		myfs_disk_truncate_blocks(inode, inode->i_size);
+		mark_inode_dirty(inode);
+	}
+}
+
+static int myfs_disk_read_folio(struct file *file, struct folio *folio)
+{
+	return block_read_full_folio(folio, myfs_disk_get_block);
+}
+
+static void myfs_disk_readahead(struct readahead_control *rac)
+{
+	mpage_readahead(rac, myfs_disk_get_block);
+}
+
+static int myfs_disk_writepage(struct page *page, struct writeback_control *wbc)
+{
+	return block_write_full_page(page, myfs_disk_get_block, wbc);
+}
+
+static int myfs_disk_writepages(struct address_space *mapping, struct writeback_control *wbc)
+{
+	return mpage_writepages(mapping, wbc, myfs_disk_get_block);
+}
+
+static int myfs_disk_write_begin(struct file *file, struct address_space *mapping,
+		loff_t pos, unsigned len, struct page **pagep, void **fsdata)
+{
+	int err;
+
+	err = block_write_begin(mapping, pos, len, pagep, myfs_disk_get_block);
+	if (err)
+		myfs_disk_write_failed(mapping, pos + len);
+
+	return err;
+}
+
+static int myfs_disk_write_end(struct file *file, struct address_space *mapping,
+		loff_t pos, unsigned len, unsigned copied, struct page *page, void *fsdata)
+{
+	int ret;
+
+	ret = generic_write_end(file, mapping, pos, len, copied, page, fsdata);
+	if (ret < len)
+		myfs_disk_write_failed(mapping, pos + len);
+
+	return ret;
+}
+
+static sector_t myfs_disk_bmap(struct address_space *mapping, sector_t block)
+{
+	return generic_block_bmap(mapping, block, myfs_disk_get_block);
+}
+
+static ssize_t myfs_disk_direct_IO(struct kiocb *iocb, struct iov_iter *iter)
+{
+	struct address_space *mapping = iocb->ki_filp->f_mapping;
+	size_t count = iov_iter_count(iter);
+	loff_t pos = iocb->ki_pos;
+	ssize_t ret;
+
+	ret = blockdev_direct_IO(iocb, mapping->host, iter, myfs_disk_get_block);
+	if (ret < 0 && iov_iter_rw(iter) == WRITE)
+		myfs_disk_write_failed(mapping, pos + count);
+
+	return ret;
+}
+
+static const struct address_space_operations myfs_disk_aops = {
+	.dirty_folio		= block_dirty_folio,
+	.invalidate_folio	= block_invalidate_folio,
+	.read_folio		= myfs_disk_read_folio,
+	.readahead		= myfs_disk_readahead,
+	.writepage		= myfs_disk_writepage,
+	.writepages		= myfs_disk_writepages,
+	.write_begin		= myfs_disk_write_begin,
+	.write_end		= myfs_disk_write_end,
+	.bmap			= myfs_disk_bmap,
+	.direct_IO		= myfs_disk_direct_IO,
+	.migrate_folio		= buffer_migrate_folio,
+	.is_partially_uptodate	= block_is_partially_uptodate,
+	.error_remove_page	= generic_error_remove_page,
+};
+
+static int myfs_disk_setattr(struct user_namespace *user_ns, struct dentry *dentry,
+		struct iattr *attr)
+{
+	struct inode *inode = d_inode(dentry);
+	int error;
+
+	error = setattr_prepare(user_ns, dentry, attr);
+	if (error)
+		return error;
+
+	if ((attr->ia_valid & ATTR_SIZE) && attr->ia_size != i_size_read(inode)) {
+		error = inode_newsize_ok(inode, attr->ia_size);
+		if (error)
+			return error;
+
+		inode_dio_wait(inode);
+		error = block_truncate_page(inode->i_mapping, attr->ia_size, myfs_disk_get_block);
+		if (error)
+			return error;
+		truncate_setsize(inode, attr->ia_size);
+		myfs_disk_truncate_blocks(inode, attr->ia_size);
+	}
+
+	setattr_copy(user_ns, inode, attr);
+	mark_inode_dirty(inode);
+
+	return 0;
+}
+
+static const struct file_operations myfs_disk_file_operations = {
+	.read_iter	= generic_file_read_iter,
+	.write_iter	= generic_file_write_iter,
+	.mmap		= generic_file_mmap,
+	.llseek		= generic_file_llseek,
+	.fsync		= generic_file_fsync,
+	.splice_read	= generic_file_splice_read,
+	.splice_write	= iter_file_splice_write,
+};
+
+static const struct inode_operations myfs_disk_file_inode_operations = {
+	.getattr	= simple_getattr,
+	.setattr	= myfs_disk_setattr,
+};
+
+/*
+ * Directories.
+ */
+
+struct myfs_disk_dir {
+	struct list_head list;
+	struct dentry *dentry;
+};
+
+static int myfs_disk_queue_dir(struct list_head *dirs, struct dentry *dentry)
+{
+	struct myfs_disk_dir *dir;
+
+	dir = kmalloc(sizeof(*dir), GFP_KERNEL);
+	if (!dir)
+		return -ENOMEM;
+	dir->dentry = dget(dentry);
+	list_add_tail(&dir->list, dirs);
+
+	return 0;
+}
+
+static int myfs_disk_store_dir_block(struct inode *dir, u32 lblk, const char *buf)
+{
+	struct myfs_extent_map *map = MYFS_I(dir)->extents;
+	struct buffer_head *bh;
+	bool new = false;
+	u32 count;
+	long pblk;
+
+	mutex_lock(&map->lock);
+	pblk = myfs_disk_map(dir, lblk, &count, &new);
+	mutex_unlock(&map->lock);
+	if (pblk < 0)
+		return pblk;
+
+	bh = sb_getblk(dir->i_sb, pblk);
+	if (!bh)
+		return -ENOMEM;
+
+	lock_buffer(bh);
+	if (!buffer_uptodate(bh) || memcmp(bh->b_data, buf, MYFS_DISK_BLOCKSIZE)) {
+		memcpy(bh->b_data, buf, MYFS_DISK_BLOCKSIZE);
+		set_buffer_uptodate(bh);
+		unlock_buffer(bh);
+		mark_buffer_dirty(bh);
+	} else {
+		unlock_buffer(bh);
+	}
+	brelse(bh);
+
+	return 0;
+}
+
+/* Rewrite the entries of @dir from its index. Called with it locked shared. */
+static int myfs_disk_store_dir(struct inode *dir, char *buf)
+{
+	struct myfs_disk_dirent *de;
+	struct dentry *dentry;
+	unsigned long cookie;
+	unsigned int off = 0, len;
+	loff_t size;
+	u32 lblk = 0;
+	int err;
+
+	memset(buf, 0, MYFS_DISK_BLOCKSIZE);
+	xa_for_each(&MYFS_I(dir)->dir_index, cookie, dentry) {
+		len = MYFS_DISK_DIRENT_LEN(dentry->d_name.len);
+		if (off + len > MYFS_DISK_BLOCKSIZE) {
+			err = myfs_disk_store_dir_block(dir, lblk++, buf);
+			if (err)
+				return err;
+			memset(buf, 0, MYFS_DISK_BLOCKSIZE);
+			off = 0;
+		}
+
+		de = (void *)buf + off;
+		de->ino = cpu_to_le32(d_inode(dentry)->i_ino);
+		de->name_len = dentry->d_name.len;
+		de->file_type = fs_umode_to_dtype(d_inode(dentry)->i_mode);
+		memcpy(de->name, dentry->d_name.name, dentry->d_name.len);
+		off += len;
+	}
+	if (off) {
+		err = myfs_disk_store_dir_block(dir, lblk++, buf);
+		if (err)
+			return err;
+	}
+
+	size = (loff_t)lblk * MYFS_DISK_BLOCKSIZE;
+	if (size != i_size_read(dir)) {
+		i_size_write(dir, size);
+		myfs_disk_truncate_blocks(dir, size);
+	}
+
+	return 0;
+}
+
+/*
+ * Write @parent and its children, queueing child directories on @dirs for
+ * a walk, or writing their inodes as well when @dirs is NULL.
+ */
+static int myfs_disk_sync_dir(struct dentry *parent, struct list_head *dirs, char *buf)
+{
+	struct inode *dir = d_inode(parent);
+	struct dentry *child;
+	unsigned long cookie;
+	int err;
+
+	/* keeps the names and the set of children stable */
+	inode_lock_shared(dir);
+	err = myfs_disk_store_dir(dir, buf);
+	xa_for_each(&MYFS_I(dir)->dir_index, cookie, child) {
+		if (err)
+			break;
+		if (d_is_dir(child) && dirs)
+			err = myfs_disk_queue_dir(dirs, child);
+		else
+			err = myfs_disk_store_inode(d_inode(child), false);
+		cond_resched();
+	}
+	inode_unlock_shared(dir);
+
+	return err ?: myfs_disk_store_inode(dir, false);
+}
+
+/*
+ * Link counts and directory times change without the inodes being marked
+ * dirty, so the whole tree is written, and the buffers that end up the same
+ * stay clean.
+ *
+ * Inodes evicted before the walk have no name left in it. Once the
+ * directories are on disk their numbers are free for good.
+ */
+static int myfs_disk_sync_tree(struct super_block *sb)
+{
+	struct myfs_disk *disk = MYFS_DISK(sb);
+	struct myfs_disk_dir *dir;
+	unsigned long ino, nr_release;
+	LIST_HEAD(dirs);
+	char *buf;
+	int err;
+
+	if (!sb->s_root)
+		return 0;
+
+	buf = kmalloc(MYFS_DISK_BLOCKSIZE, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	mutex_lock(&disk->sync_lock);
+	spin_lock(&disk->lock);
+	nr_release = disk->nr_ifree;
+	if (nr_release) {
+		bitmap_copy(disk->ifree_sync, disk->ifree, disk->nr_inodes);
+		bitmap_zero(disk->ifree, disk->nr_inodes);
+		disk->nr_ifree = 0;
+	}
+	spin_unlock(&disk->lock);
+
+	err = myfs_disk_queue_dir(&dirs, sb->s_root);
+	while (!list_empty(&dirs)) {
+		dir = list_first_entry(&dirs, struct myfs_disk_dir, list);
+		list_del(&dir->list);
+		if (!err)
+			err = myfs_disk_sync_dir(dir->dentry, &dirs, buf);
+		dput(dir->dentry);
+		kfree(dir);
+		cond_resched();
+	}
+
+	if (nr_release) {
+		if (!err)
+			err = sync_blockdev(sb->s_bdev);
+
+		spin_lock(&disk->lock);
+		if (err) {
+			bitmap_or(disk->ifree, disk->ifree, disk->ifree_sync, disk->nr_inodes);
+			disk->nr_ifree += nr_release;
+		} else {
+			for_each_set_bit(ino, disk->ifree_sync, disk->nr_inodes)
+				myfs_disk_bitmap_free(disk->imap, ino);
+			disk->free_inodes += nr_release;
+		}
+		spin_unlock(&disk->lock);
+	}
+	mutex_unlock(&disk->sync_lock);
+	kfree(buf);
+
+	return err;
+}
+
+/*
+ * The entries of the directory and the inodes of its children, whose link
+ * counts change with them, then everything dirty in the buffer cache of
+ * the device, which has the bitmaps and blocks allocated for them.
+ */
+int myfs_disk_fsync_dir(struct file *file, int datasync)
+{
+	struct super_block *sb = file_inode(file)->i_sb;
+	struct myfs_disk *disk = MYFS_DISK(sb);
+	char *buf;
+	int err;
+
+	buf = kmalloc(MYFS_DISK_BLOCKSIZE, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	mutex_lock(&disk->sync_lock);
+	err = myfs_disk_sync_dir(file->f_path.dentry, NULL, buf);
+	mutex_unlock(&disk->sync_lock);
+	kfree(buf);
+
+	if (!err)
+		err = sync_blockdev(sb->s_bdev);
+	if (!err)
+		err = blkdev_issue_flush(sb->s_bdev);
+
+	return err;
+}
+
+static int myfs_disk_load_entry(struct dentry *parent, const struct myfs_disk_dirent *de,
+		struct list_head *dirs)
+{
+	struct super_block *sb = parent->d_sb;
+	struct qstr name = QSTR_INIT(de->name, de->name_len);
+	unsigned long ino = le32_to_cpu(de->ino);
+	struct dentry *dentry, *old;
+	struct inode *inode;
+	int err;
+
+	if (ino >= MYFS_DISK(sb)->nr_inodes || memchr(de->name, '/', de->name_len) ||
+	    memchr(de->name, 0, de->name_len) ||
+	    (de->name[0] == '.' && (de->name_len == 1 || (de->name_len == 2 && de->name[1] == '.'))))
+		return -EUCLEAN;
+
+	old = d_hash_and_lookup(parent, &name);
+	if (old) {
+		dput(old);
+		return -EUCLEAN;
+	}
+
+	inode = myfs_disk_iget(sb, ino);
+	if (IS_ERR(inode))
+		return PTR_ERR(inode);
+
+	/* a directory has a single name, and the root none */
+	if (fs_umode_to_dtype(inode->i_mode) != de->file_type ||
+	    (S_ISDIR(inode->i_mode) && (ino == MYFS_DISK_ROOT_INO || !hlist_empty(&inode->i_dentry)))) {
+		iput(inode);
+		return -EUCLEAN;
+	}
+
+	/* the reference from d_alloc pins the dentry, as in myfs_mknod */
+	name.hash = full_name_hash(parent, name.name, name.len);
+	dentry = d_alloc(parent, &name);
+	if (!dentry) {
+		iput(inode);
+		return -ENOMEM;
+	}
+	err = myfs_dir_add(d_inode(parent), dentry);
+	if (err) {
+		dput(dentry);
+		iput(inode);
+		return err;
+	}
+	d_add(dentry, inode);
+
+	return d_is_dir(dentry) ? myfs_disk_queue_dir(dirs, dentry) : 0;
+}
+
+static int myfs_disk_load_dir(struct dentry *parent, struct list_head *dirs)
+{
+	struct inode *dir = d_inode(parent);
+	struct myfs_extent_map *map = MYFS_I(dir)->extents;
+	const struct myfs_disk_dirent *de;
+	struct buffer_head *bh;
+	unsigned int off, len;
+	loff_t size = i_size_read(dir);
+	u32 lblk, count;
+	long pblk;
+	int err = 0;
+
+	if (size & (MYFS_DISK_BLOCKSIZE - 1) || size >> dir->i_blkbits > U32_MAX)
+		return -EUCLEAN;
+
+	for (lblk = 0; lblk < size >> dir->i_blkbits; lblk++) {
+		mutex_lock(&map->lock);
+		pblk = myfs_disk_map(dir, lblk, &count, NULL);
+		mutex_unlock(&map->lock);
+		if (!pblk)
+			return -EUCLEAN;
+
+		bh = sb_bread(dir->i_sb, pblk);
+		if (!bh)
+			return -EIO;
+
+		for (off = 0; off + sizeof(*de) <= MYFS_DISK_BLOCKSIZE; off += len) {
+			de = (void *)bh->b_data + off;
+			if (!de->ino)
+				break;
+
+			len = MYFS_DISK_DIRENT_LEN(de->name_len);
+			if (!de->name_len || off + len > MYFS_DISK_BLOCKSIZE) {
+				err = -EUCLEAN;
+				break;
+			}
+			err = myfs_disk_load_entry(parent, de, dirs);
+			if (err)
+				break;
+		}
+		brelse(bh);
+		if (err)
+			return err;
+		cond_resched();
+	}
+
+	return 0;
+}
+
+/* Read the whole tree into the dcache, breadth first, as the image loader does. */
+static int myfs_disk_load_tree(struct super_block *sb)
+{
+	struct myfs_disk_dir *dir;
+	LIST_HEAD(dirs);
+	int err;
+
+	err = myfs_disk_queue_dir(&dirs, sb->s_root);
+	while (!list_empty(&dirs)) {
+		dir = list_first_entry(&dirs, struct myfs_disk_dir, list);
+		list_del(&dir->list);
+		if (!err)
+			err = myfs_disk_load_dir(dir->dentry, &dirs);
+		dput(dir->dentry);
+		kfree(dir);
+	}
+
+	return err;
+}
+
+/*
+ * Superblock.
+ */
+
+static int myfs_disk_sync_fs(struct super_block *sb, int wait)
+{
+	/* the waiting pass writes out the inodes this one dirtied */
+	return wait ? 0 : myfs_disk_sync_tree(sb);
+}
+
+static int myfs_disk_statfs(struct dentry *dentry, struct kstatfs *buf)
+{
+	struct super_block *sb = dentry->d_sb;
+	struct myfs_disk *disk = MYFS_DISK(sb);
+
+	buf->f_type = MYFS_DISK_MAGIC;
+	buf->f_bsize = MYFS_DISK_BLOCKSIZE;
+	buf->f_namelen = NAME_MAX;
+	buf->f_blocks = disk->nr_blocks - disk->data_start;
+	buf->f_files = disk->nr_inodes - 1;
+	spin_lock(&disk->lock);
+	buf->f_bfree = buf->f_bavail = disk->free_blocks;
+	buf->f_ffree = disk->free_inodes;
+	spin_unlock(&disk->lock);
+	buf->f_fsid = u64_to_fsid(huge_encode_dev(sb->s_bdev->bd_dev));
+
+	return 0;
+}
+
+static void myfs_disk_release(struct myfs_disk *disk)
+{
+	unsigned int i;
+
+	for (i = 0; disk->imap && i < disk->nr_imap; i++)
+		brelse(disk->imap[i]);
+	for (i = 0; disk->bmap && i < disk->nr_bmap; i++)
+		brelse(disk->bmap[i]);
+	kfree(disk->imap);
+	kfree(disk->bmap);
+	disk->imap = disk->bmap = NULL;
+	bitmap_free(disk->ifree);
+	bitmap_free(disk->ifree_sync);
+	disk->ifree = disk->ifree_sync = NULL;
+}
+
+static void myfs_disk_put_super(struct super_block *sb)
+{
+	myfs_disk_release(MYFS_DISK(sb));
+}
+
+static const struct super_operations myfs_disk_ops = {
+	.alloc_inode	= myfs_alloc_inode,
+	.free_inode	= myfs_free_inode,
+	.evict_inode	= myfs_disk_evict_inode,
+	.write_inode	= myfs_disk_write_inode,
+	.drop_inode	= generic_drop_inode,
+	.sync_fs	= myfs_disk_sync_fs,
+	.put_super	= myfs_disk_put_super,
+	.statfs		= myfs_disk_statfs,
+};
+
+static int myfs_disk_read_bitmap(struct super_block *sb, unsigned int start, unsigned int nr,
+		struct buffer_head ***map, unsigned long *free)
+{
+	struct buffer_head **bhs;
+	unsigned int i;
+
+	bhs = kcalloc(nr, sizeof(*bhs), GFP_KERNEL);
+	if (!bhs)
+		return -ENOMEM;
+	*map = bhs;
+
+	/* the bits past the end are set, so every clear bit is a free one */
+	for (i = 0; i < nr; i++) {
+		bhs[i] = sb_bread(sb, start + i);
+		if (!bhs[i])
+			return -EIO;
+		*free += MYFS_DISK_BITS - memweight(bhs[i]->b_data, MYFS_DISK_BLOCKSIZE);
+	}
+
+	return 0;
+}
+
+static int myfs_disk_read_super(struct super_block *sb, int silent)
+{
+	struct myfs_disk *disk = MYFS_DISK(sb);
+	struct myfs_disk_super *ds;
+	struct buffer_head *bh;
+	u32 inode_bitmap, block_bitmap;
+	int err = -EINVAL;
+
+	bh = sb_bread(sb, 0);
+	if (!bh)
+		return -EIO;
+	ds = (struct myfs_disk_super *)bh->b_data;
+
+	if (le32_to_cpu(ds->magic) != MYFS_DISK_MAGIC) {
+		if (!silent)
+			pr_err("myfs: no myfs_disk filesystem on %pg\n", sb->s_bdev);
+		goto out;
+	}
+	if (le32_to_cpu(ds->version) != MYFS_DISK_VERSION ||
+	    le32_to_cpu(ds->blocksize) != MYFS_DISK_BLOCKSIZE ||
+	    le32_to_cpu(ds->inode_size) != MYFS_DISK_INODE_SIZE) {
+		pr_err("myfs: unsupported format on %pg\n", sb->s_bdev);
+		goto out;
+	}
+
+	disk->nr_blocks = le32_to_cpu(ds->nr_blocks);
+	disk->nr_inodes = le32_to_cpu(ds->nr_inodes);
+	inode_bitmap = le32_to_cpu(ds->inode_bitmap);
+	block_bitmap = le32_to_cpu(ds->block_bitmap);
+	disk->inode_table = le32_to_cpu(ds->inode_table);
+	disk->data_start = le32_to_cpu(ds->data_start);
+	disk->nr_imap = DIV_ROUND_UP(disk->nr_inodes, MYFS_DISK_BITS);
+	disk->nr_bmap = DIV_ROUND_UP(disk->nr_blocks, MYFS_DISK_BITS);
+
+	if (disk->nr_inodes <= MYFS_DISK_ROOT_INO || inode_bitmap != 1 ||
+	    block_bitmap != (u64)inode_bitmap + disk->nr_imap ||
+	    disk->inode_table != (u64)block_bitmap + disk->nr_bmap ||
+	    disk->data_start != (u64)disk->inode_table +
+				DIV_ROUND_UP(disk->nr_inodes, MYFS_DISK_INODES_PER_BLOCK) ||
+	    disk->data_start >= disk->nr_blocks ||
+	    disk->nr_blocks > bdev_nr_bytes(sb->s_bdev) / MYFS_DISK_BLOCKSIZE) {
+		err = -EUCLEAN;
+		goto out;
+	}
+
+	disk->ifree = bitmap_zalloc(disk->nr_inodes, GFP_KERNEL);
+	disk->ifree_sync = bitmap_zalloc(disk->nr_inodes, GFP_KERNEL);
+	if (!disk->ifree || !disk->ifree_sync) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	err = myfs_disk_read_bitmap(sb, inode_bitmap, disk->nr_imap, &disk->imap,
+				    &disk->free_inodes);
+	if (!err)
+		err = myfs_disk_read_bitmap(sb, block_bitmap, disk->nr_bmap, &disk->bmap,
+					    &disk->free_blocks);
+out:
+	brelse(bh);
+	return err;
+}
+
+static int myfs_disk_fill_super(struct super_block *sb, void *data, int silent)
+{
+	struct myfs_sb_info *sbi;
+	struct myfs_disk *disk;
+	struct inode *root;
+	int err;
+
+	BUILD_BUG_ON(sizeof(struct myfs_disk_inode) != MYFS_DISK_INODE_SIZE);
+
+	sbi = kzalloc(sizeof(struct myfs_sb_info), GFP_KERNEL);
+	if (!sbi)
+		return -ENOMEM;
+	sb->s_fs_info = sbi;
+
+	disk = kzalloc(sizeof(*disk), GFP_KERNEL);
+	if (!disk)
+		return -ENOMEM;
+	sbi->disk = disk;
+	spin_lock_init(&disk->lock);
+	mutex_init(&disk->sync_lock);
+
+	sbi->blocksize = MYFS_DISK_BLOCKSIZE;
+	sbi->blocksize_bits = ilog2(MYFS_DISK_BLOCKSIZE);
+	spin_lock_init(&sbi->inodes_lock);
+	INIT_LIST_HEAD(&sbi->inodes);
+	mutex_init(&sbi->image_lock);
+
+	if (data && *(char *)data) {
+		pr_err("myfs: myfs_disk takes no mount options\n");
+		return -EINVAL;
+	}
+
+	err = percpu_counter_init(&sbi->used_inodes, 0, GFP_KERNEL);
+	if (err)
+		return err;
+
+	if (!sb_set_blocksize(sb, MYFS_DISK_BLOCKSIZE)) {
+		pr_err("myfs: %pg does not support %u byte blocks\n", sb->s_bdev,
+		       MYFS_DISK_BLOCKSIZE);
+		return -EINVAL;
+	}
+
+	err = myfs_disk_read_super(sb, silent);
+	if (err)
+		goto out_release;
+
+	sb->s_magic = MYFS_DISK_MAGIC;
+	sb->s_op = &myfs_disk_ops;
+	sb->s_maxbytes = min_t(loff_t, MAX_LFS_FILESIZE, (loff_t)U32_MAX << sbi->blocksize_bits);
+	sb->s_max_links = U16_MAX;
+	sb->s_flags |= SB_NOSEC;
+
+	root = myfs_disk_iget(sb, MYFS_DISK_ROOT_INO);
+	if (IS_ERR(root)) {
+		err = PTR_ERR(root);
+		goto out_release;
+	}
+	if (!S_ISDIR(root->i_mode)) {
+		iput(root);
+		err = -EUCLEAN;
+		goto out_release;
+	}
+
+	sb->s_root = d_make_root(root);
+	if (!sb->s_root) {
+		err = -ENOMEM;
+		goto out_release;
+	}
+
+	err = myfs_disk_load_tree(sb);
+	if (err)
+		goto out_release;
+
+	return 0;
+
+out_release:
+	if (err == -EUCLEAN)
+		pr_err("myfs: corrupt metadata on %pg\n", sb->s_bdev);
+	myfs_disk_release(disk);
+	return err;
+}
+
+static struct dentry *myfs_disk_mount(struct file_system_type *fs_type,
+		int flags, const char *dev_name, void *data)
+{
+	return mount_bdev(fs_type, flags, dev_name, data, myfs_disk_fill_super);
+}
+
+static void myfs_disk_kill_sb(struct super_block *sb)
+{
+	struct myfs_sb_info *sbi = MYFS_SB(sb);
+
+	/* the tree is written from the dcache, so before it goes */
+	if (sb->s_root && (sb->s_flags & SB_ACTIVE))
+		sync_filesystem(sb);
+	if (sb->s_root)
+		d_genocide(sb->s_root);
+
+	kill_block_super(sb);
+
+	if (sbi) {
+		percpu_counter_destroy(&sbi->used_inodes);
+		kfree(sbi->disk);
+		kfree(sbi);
+	}
+}
+
+struct file_system_type myfs_disk_fs_type = {
+	.owner		= THIS_MODULE,
+	.name		= "myfs_disk",
+	.mount		= myfs_disk_mount,
+	.kill_sb	= myfs_disk_kill_sb,
+	.fs_flags	= FS_REQUIRES_DEV,
+};
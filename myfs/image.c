@@ -0,0 +1,724 @@
+/*
+ * Dump and restore of a whole mount.
+ *
+ * With image=<path> the mount is populated from the image at that path, if
+ * there is one, and written back to it at umount. The MYFS_IOC_DUMP ioctl
+ * on any file or directory of the mount writes it out on request.
+ *
+ * The image is a stream: a header, then one record per directory entry in
+ * breadth-first order, so a parent always comes before its children, and
+ * an end record. The first record is the root itself. Records refer to
+ * inodes by the inode number they had when dumped; a regular file with
+ * more than one name is dumped once and its other names become link
+ * records. File records are followed by the non-hole blocks of the file,
+ * each with its index and length, and a terminating block header. Blocks
+ * are stored uncompressed and unshared; the compression and dedup passes
+ * find them again after a restore.
+ *
+ * Both directions go through a large buffer, so the image is read and
+ * written in sequential chunks whatever the shape of the tree, and its
+ * pages are dropped from the page cache once done with. A dump is written
+ * to <path>.tmp and renamed over the image once it is on disk, so a crash
+ * or a failed dump leaves the previous image in place.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/fadvise.h>
+#include <linux/namei.h>
+#include <linux/dcache.h>
+#include <linux/mount.h>
+#include <linux/string.h>
+
+#include "myfs.h"
+
+#define MYFS_IMG_MAGIC		"MYFSIMG1"
+#define MYFS_IMG_VERSION	1
+#define MYFS_IMG_CHUNK		SZ_1M
+
+/* block header index that ends the data of a file */
+#define MYFS_IMG_EOF		U64_MAX
+
+enum {
+	MYFS_IMG_DIR = 1,
+	MYFS_IMG_FILE,		/* any other kind of inode, with data if regular */
+	MYFS_IMG_LINK,		/* another name for an inode already in the image */
+	MYFS_IMG_END,
+};
+
+struct myfs_img_header {
+	char magic[8];
+	__le32 version;
+	__le32 blocksize;
+};
+
+struct myfs_img_inode {
+	__le16 type;
+	__le16 namelen;
+	__le32 mode;
+	__le64 ino;
+	__le64 parent;
+	__le32 uid;
+	__le32 gid;
+	__le64 size;
+	__le64 atime;
+	__le64 mtime;
+	__le64 ctime;
+	__le32 atime_nsec;
+	__le32 mtime_nsec;
+	__le32 ctime_nsec;
+	__le32 reserved;
+};
+
+struct myfs_img_block {
+	__le64 index;
+	__le32 len;
+	__le32 reserved;
+};
+
+struct myfs_img_stream {
+	struct file *file;
+	loff_t pos;
+	char *buf;
+	size_t len;	/* bytes in buf */
+	size_t off;	/* bytes of buf already consumed, when reading */
+};
+
+static int myfs_img_flush(struct myfs_img_stream *s)
+{
+	ssize_t ret;
+
+	if (!s->len)
+		return 0;
+
+	ret = kernel_write(s->file, s->buf, s->len, &s->pos);
+	if (ret != s->len)
+		return ret < 0 ? ret : -EIO;
+	s->len = 0;
+
+	return 0;
+}
+
+static int myfs_img_write(struct myfs_img_stream *s, const void *src, size_t len)
+{
+	size_t chunk;
+	int err;
+
+	while (len) {
+		if (s->len == MYFS_IMG_CHUNK) {
+			err = myfs_img_flush(s);
+			if (err)
+				return err;
+		}
+
+		chunk = min(len, MYFS_IMG_CHUNK - s->len);
+		memcpy(s->buf + s->len, src, chunk);
+		s->len += chunk;
+		src += chunk;
+		len -= chunk;
+	}
+
+	return 0;
+}
+
+static int myfs_img_read(struct myfs_img_stream *s, void *dst, size_t len)
+{
+	size_t chunk;
+	ssize_t ret;
+
+	while (len) {
+		if (s->off == s->len) {
+			ret = kernel_read(s->file, s->buf, MYFS_IMG_CHUNK, &s->pos);
+			if (ret < 0)
+				return ret;
+			if (!ret)
+				return -EIO;
+			s->len = ret;
+			s->off = 0;
+		}
+
+		chunk = min(len, s->len - s->off);
+		memcpy(dst, s->buf + s->off, chunk);
+		s->off += chunk;
+		dst += chunk;
+		len -= chunk;
+	}
+
+	return 0;
+}
+
+struct myfs_img_dump {
+	struct myfs_img_stream s;
+	struct xarray linked;	/* inodes with several names already dumped */
+	struct list_head dirs;	/* directories still to walk */
+	char *bounce;
+};
+
+struct myfs_img_dir {
+	struct list_head list;
+	struct dentry *dentry;
+};
+
+static int myfs_img_queue_dir(struct myfs_img_dump *d, struct dentry *dentry)
+{
+	struct myfs_img_dir *dir;
+
+	dir = kmalloc(sizeof(*dir), GFP_KERNEL);
+	if (!dir)
+		return -ENOMEM;
+	dir->dentry = dget(dentry);
+	list_add_tail(&dir->list, &d->dirs);
+
+	return 0;
+}
+
+static int myfs_img_dump_inode(struct myfs_img_dump *d, int type, struct inode *inode,
+		struct inode *parent, const struct qstr *name)
+{
+	struct myfs_img_inode rec = {
+		.type		= cpu_to_le16(type),
+		.namelen	= cpu_to_le16(name ? name->len : 0),
+		.mode		= cpu_to_le32(inode->i_mode),
+		.ino		= cpu_to_le64(inode->i_ino),
+		.parent		= cpu_to_le64(parent ? parent->i_ino : 0),
+		.uid		= cpu_to_le32(i_uid_read(inode)),
+		.gid		= cpu_to_le32(i_gid_read(inode)),
+		.size		= cpu_to_le64(i_size_read(inode)),
+		.atime		= cpu_to_le64(inode->i_atime.tv_sec),
+		.mtime		= cpu_to_le64(inode->i_mtime.tv_sec),
+		.ctime		= cpu_to_le64(inode->i_ctime.tv_sec),
+		.atime_nsec	= cpu_to_le32(inode->i_atime.tv_nsec),
+		.mtime_nsec	= cpu_to_le32(inode->i_mtime.tv_nsec),
+		.ctime_nsec	= cpu_to_le32(inode->i_ctime.tv_nsec),
+	};
+	int err;
+
+	err = myfs_img_write(&d->s, &rec, sizeof(rec));
+	if (!err && name)
+		err = myfs_img_write(&d->s, name->name, name->len);
+
+	return err;
+}
+
+/*
+ * Plain unshared blocks cannot change under the caller's locks and are
+ * written out directly. Compressed and swapped ones are brought in by a
+ * racing read_folio, which replaces the entry, so they go through the
+ * bounce buffer, as do shared ones to keep to the RCU rules for those.
+ */
+static int myfs_img_dump_block(struct myfs_img_dump *d, struct inode *inode,
+		unsigned long index, void *entry, size_t len)
+{
+	struct myfs_sb_info *sbi = MYFS_SB(inode->i_sb);
+	struct myfs_img_block hdr = {
+		.index	= cpu_to_le64(index),
+		.len	= cpu_to_le32(len),
+	};
+	const char *src = entry;
+	int err;
+
+	if (!entry || myfs_entry_offline(entry) ||
+	    xa_get_mark(&MYFS_I(inode)->blocks, index, MYFS_MARK_SHARED)) {
+		err = myfs_copy_from_blocks(inode, d->bounce,
+					    (loff_t)index << sbi->blocksize_bits, len);
+		if (err)
+			return err;
+		src = d->bounce;
+	}
+
+	err = myfs_img_write(&d->s, &hdr, sizeof(hdr));
+	if (!err)
+		err = myfs_img_write(&d->s, src, len);
+
+	return err;
+}
+
+/*
+ * Called with the inode locked, which keeps out writers, including the
+ * in-place ones that hold it shared, and the passes that replace blocks.
+ * block_rwsem keeps out writepage of pages dirtied through mmap since.
+ */
+static int myfs_img_dump_data(struct myfs_img_dump *d, struct inode *inode)
+{
+	struct myfs_inode_info *info = MYFS_I(inode);
+	struct myfs_sb_info *sbi = MYFS_SB(inode->i_sb);
+	struct myfs_img_block end = { .index = cpu_to_le64(MYFS_IMG_EOF) };
+	loff_t size = i_size_read(inode);
+	unsigned long index;
+	void *entry;
+	loff_t pos;
+	int err;
+
+	/* pick up what was written through mmap */
+	err = filemap_write_and_wait(inode->i_mapping);
+	if (err)
+		return err;
+
+	down_write(&info->block_rwsem);
+	if (myfs_is_inline(inode)) {
+		if (size)
+			err = myfs_img_dump_block(d, inode, 0, NULL,
+						  min_t(loff_t, size, myfs_inline_size));
+	} else {
+		xa_for_each(&info->blocks, index, entry) {
+			pos = (loff_t)index << sbi->blocksize_bits;
+			if (pos >= size)
+				break;
+			if (entry == sbi->zero_block)
+				continue;
+
+			err = myfs_img_dump_block(d, inode, index, entry,
+						  min_t(loff_t, sbi->blocksize, size - pos));
+			if (err)
+				break;
+			cond_resched();
+		}
+	}
+	up_write(&info->block_rwsem);
+
+	if (!err)
+		err = myfs_img_write(&d->s, &end, sizeof(end));
+
+	return err;
+}
+
+static int myfs_img_dump_child(struct myfs_img_dump *d, struct dentry *parent,
+		struct dentry *dentry)
+{
+	struct inode *inode = d_inode(dentry);
+	int err;
+
+	if (d_is_dir(dentry)) {
+		err = myfs_img_dump_inode(d, MYFS_IMG_DIR, inode, d_inode(parent),
+					  &dentry->d_name);
+		return err ?: myfs_img_queue_dir(d, dentry);
+	}
+
+	if (inode->i_nlink > 1) {
+		if (xa_load(&d->linked, inode->i_ino))
+			return myfs_img_dump_inode(d, MYFS_IMG_LINK, inode, d_inode(parent),
+						   &dentry->d_name);
+		err = xa_err(xa_store(&d->linked, inode->i_ino, xa_mk_value(1), GFP_KERNEL));
+		if (err)
+			return err;
+	}
+
+	err = myfs_img_dump_inode(d, MYFS_IMG_FILE, inode, d_inode(parent), &dentry->d_name);
+	if (err || !S_ISREG(inode->i_mode))
+		return err;
+
+	inode_lock_nested(inode, I_MUTEX_CHILD);
+	inode_dio_wait(inode);
+	err = myfs_img_dump_data(d, inode);
+	inode_unlock(inode);
+
+	return err;
+}
+
+static int myfs_img_dump_dir(struct myfs_img_dump *d, struct dentry *parent)
+{
+	struct dentry *child;
+	unsigned long cookie;
+	int err = 0;
+
+	/* keeps the names and the set of children stable */
+	inode_lock_shared(d_inode(parent));
+	xa_for_each(&MYFS_I(d_inode(parent))->dir_index, cookie, child) {
+		err = myfs_img_dump_child(d, parent, child);
+		if (err)
+			break;
+		cond_resched();
+	}
+	inode_unlock_shared(d_inode(parent));
+
+	return err;
+}
+
+static int myfs_img_dump_tree(struct myfs_img_dump *d, struct super_block *sb)
+{
+	struct myfs_img_header hdr = {
+		.magic		= MYFS_IMG_MAGIC,
+		.version	= cpu_to_le32(MYFS_IMG_VERSION),
+		.blocksize	= cpu_to_le32(MYFS_SB(sb)->blocksize),
+	};
+	struct myfs_img_inode end = { .type = cpu_to_le16(MYFS_IMG_END) };
+	struct myfs_img_dir *dir;
+	int err;
+
+	err = myfs_img_write(&d->s, &hdr, sizeof(hdr));
+	if (!err)
+		err = myfs_img_dump_inode(d, MYFS_IMG_DIR, d_inode(sb->s_root), NULL, NULL);
+	if (!err)
+		err = myfs_img_queue_dir(d, sb->s_root);
+
+	while (!list_empty(&d->dirs)) {
+		dir = list_first_entry(&d->dirs, struct myfs_img_dir, list);
+		list_del(&dir->list);
+		if (!err)
+			err = myfs_img_dump_dir(d, dir->dentry);
+		dput(dir->dentry);
+		kfree(dir);
+	}
+
+	if (!err)
+		err = myfs_img_write(&d->s, &end, sizeof(end));
+	if (!err)
+		err = myfs_img_flush(&d->s);
+
+	return err;
+}
+
+/*
+ * Rename the dumped @file over @image, or unlink it when @err is set.
+ * @file was opened as <image>.tmp, so both names are in one directory.
+ */
+static int myfs_img_replace(struct file *file, const char *image, int err)
+{
+	struct dentry *dentry = file->f_path.dentry;
+	struct vfsmount *mnt = file->f_path.mnt;
+	const char *name = kbasename(image);
+	struct dentry *parent, *target;
+	struct inode *dir;
+	int ret;
+
+	ret = mnt_want_write(mnt);
+	if (ret)
+		return err ?: ret;
+
+	parent = dget_parent(dentry);
+	dir = d_inode(parent);
+	inode_lock_nested(dir, I_MUTEX_PARENT);
+
+	/* moved or removed behind our back: nothing to replace or clean up */
+	if (dentry->d_parent != parent || d_unhashed(dentry)) {
+		ret = -ENOENT;
+		goto out;
+	}
+
+	if (err) {
+		ret = vfs_unlink(mnt_user_ns(mnt), dir, dentry, NULL);
+		goto out;
+	}
+
+	target = lookup_one_len(name, parent, strlen(name));
+	if (IS_ERR(target)) {
+		ret = PTR_ERR(target);
+	} else {
+		struct renamedata rd = {
+			.old_mnt_userns	= mnt_user_ns(mnt),
+			.old_dir	= dir,
+			.old_dentry	= dentry,
+			.new_mnt_userns	= mnt_user_ns(mnt),
+			.new_dir	= dir,
+			.new_dentry	= target,
+		};
+
+		ret = vfs_rename(&rd);
+		dput(target);
+	}
+
+out:
+	inode_unlock(dir);
+	dput(parent);
+	mnt_drop_write(mnt);
+
+	return err ?: ret;
+}
+
+int myfs_image_dump(struct super_block *sb)
+{
+	struct myfs_sb_info *sbi = MYFS_SB(sb);
+	struct myfs_img_dump d = {};
+	char *tmp = NULL;
+	int err = -ENOMEM;
+
+	if (!sbi->image)
+		return -EINVAL;
+
+	xa_init(&d.linked);
+	INIT_LIST_HEAD(&d.dirs);
+	d.s.buf = kvmalloc(MYFS_IMG_CHUNK, GFP_KERNEL);
+	d.bounce = kvmalloc(sbi->blocksize, GFP_KERNEL);
+	tmp = kasprintf(GFP_KERNEL, "%s.tmp", sbi->image);
+	if (!d.s.buf || !d.bounce || !tmp)
+		goto out;
+
+	mutex_lock(&sbi->image_lock);
+	d.s.file = filp_open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, 0600);
+	if (IS_ERR(d.s.file)) {
+		err = PTR_ERR(d.s.file);
+	} else {
+		err = myfs_img_dump_tree(&d, sb);
+		if (!err)
+			err = vfs_fsync(d.s.file, 0);
+		/* written back already, the copy in the page cache is of no use */
+		if (!err)
+			vfs_fadvise(d.s.file, 0, 0, POSIX_FADV_DONTNEED);
+		err = myfs_img_replace(d.s.file, sbi->image, err);
+		filp_close(d.s.file, NULL);
+	}
+	mutex_unlock(&sbi->image_lock);
+
+out:
+	if (err)
+		pr_err("myfs: cannot dump to image '%s': %d\n", sbi->image, err);
+	kfree(tmp);
+	kvfree(d.bounce);
+	kvfree(d.s.buf);
+	xa_destroy(&d.linked);
+
+	return err;
+}
+
+struct myfs_img_load {
+	struct myfs_img_stream s;
+	struct super_block *sb;
+	struct xarray dentries;	/* inode number in the image -> dentry */
+	unsigned int blocksize;
+	unsigned char blocksize_bits;
+	char *bounce;
+};
+
+static void myfs_img_set_attr(struct inode *inode, const struct myfs_img_inode *rec)
+{
+	inode->i_mode = le32_to_cpu(rec->mode);
+	i_uid_write(inode, le32_to_cpu(rec->uid));
+	i_gid_write(inode, le32_to_cpu(rec->gid));
+	inode->i_atime.tv_sec = le64_to_cpu(rec->atime);
+	inode->i_atime.tv_nsec = le32_to_cpu(rec->atime_nsec);
+	inode->i_mtime.tv_sec = le64_to_cpu(rec->mtime);
+	inode->i_mtime.tv_nsec = le32_to_cpu(rec->mtime_nsec);
+	inode->i_ctime.tv_sec = le64_to_cpu(rec->ctime);
+	inode->i_ctime.tv_nsec = le32_to_cpu(rec->ctime_nsec);
+}
+
+/*
+ * Blocks of the image's block size go straight from the stream into newly
+ * allocated blocks; anything else is copied through the bounce buffer.
+ */
+static int myfs_img_load_data(struct myfs_img_load *ld, struct inode *inode, loff_t size)
+{
+	struct myfs_sb_info *sbi = MYFS_SB(inode->i_sb);
+	struct myfs_img_block hdr;
+	unsigned long index;
+	size_t len;
+	loff_t pos;
+	char *block;
+	int err;
+
+	if (size > myfs_inline_size)
+		clear_bit(MYFS_I_INLINE, &MYFS_I(inode)->flags);
+	i_size_write(inode, size);
+
+	for (;;) {
+		err = myfs_img_read(&ld->s, &hdr, sizeof(hdr));
+		if (err)
+			return err;
+		if (le64_to_cpu(hdr.index) == MYFS_IMG_EOF)
+			return 0;
+
+		index = le64_to_cpu(hdr.index);
+		len = le32_to_cpu(hdr.len);
+		pos = (loff_t)index << ld->blocksize_bits;
+		if (!len || len > ld->blocksize || index > (MAX_LFS_FILESIZE >> ld->blocksize_bits) ||
+		    pos + len > size)
+			return -EINVAL;
+
+		if (ld->blocksize == sbi->blocksize && !myfs_is_inline(inode)) {
+			block = myfs_get_block(inode, index, MYFS_GB_CREATE);
+			if (IS_ERR(block))
+				return PTR_ERR(block);
+			err = myfs_img_read(&ld->s, block, len);
+		} else {
+			err = myfs_img_read(&ld->s, ld->bounce, len);
+			if (!err)
+				err = myfs_copy_to_blocks(inode, ld->bounce, pos, len);
+		}
+		if (err)
+			return err;
+		cond_resched();
+	}
+}
+
+static int myfs_img_load_inode(struct myfs_img_load *ld, const struct myfs_img_inode *rec,
+		const char *name)
+{
+	unsigned int type = le16_to_cpu(rec->type);
+	umode_t mode = le32_to_cpu(rec->mode);
+	struct dentry *parent, *dentry, *old;
+	struct inode *inode;
+	loff_t size = le64_to_cpu(rec->size);
+	struct qstr qname = QSTR_INIT(name, le16_to_cpu(rec->namelen));
+	int err;
+
+	if ((type == MYFS_IMG_DIR) != S_ISDIR(mode) || fs_umode_to_dtype(mode) == DT_UNKNOWN ||
+	    size < 0 || size > MAX_LFS_FILESIZE)
+		return -EINVAL;
+
+	parent = xa_load(&ld->dentries, le64_to_cpu(rec->parent));
+	if (!parent || !d_is_dir(parent) || !qname.len)
+		return -EINVAL;
+
+	old = d_hash_and_lookup(parent, &qname);
+	if (old) {
+		dput(old);
+		return -EINVAL;
+	}
+
+	if (type == MYFS_IMG_LINK) {
+		old = xa_load(&ld->dentries, le64_to_cpu(rec->ino));
+		if (!old || d_is_dir(old))
+			return -EINVAL;
+		inode = d_inode(old);
+		ihold(inode);
+		inc_nlink(inode);
+	} else {
+		inode = myfs_get_inode(ld->sb, d_inode(parent), mode);
+		if (!inode)
+			return -ENOSPC;
+		myfs_img_set_attr(inode, rec);
+	}
+
+	/* the reference from d_alloc_name pins the dentry, as in myfs_mknod */
+	dentry = d_alloc_name(parent, name);
+	if (!dentry) {
+		iput(inode);
+		return -ENOMEM;
+	}
+	err = myfs_dir_add(d_inode(parent), dentry);
+	if (err) {
+		dput(dentry);
+		iput(inode);
+		return err;
+	}
+	d_add(dentry, inode);
+
+	if (type == MYFS_IMG_LINK)
+		return 0;
+	if (type == MYFS_IMG_DIR)
+		inc_nlink(d_inode(parent));
+
+	err = xa_insert(&ld->dentries, le64_to_cpu(rec->ino), dentry, GFP_KERNEL);
+	if (err)
+		return err == -EBUSY ? -EINVAL : err;
+
+	return S_ISREG(mode) ? myfs_img_load_data(ld, inode, size) : 0;
+}
+
+static int myfs_img_load_tree(struct myfs_img_load *ld)
+{
+	struct dentry *root = ld->sb->s_root;
+	struct myfs_img_header hdr;
+	struct myfs_img_inode rec;
+	unsigned int namelen;
+	char *name;
+	int err;
+
+	err = myfs_img_read(&ld->s, &hdr, sizeof(hdr));
+	if (err)
+		return err;
+
+	ld->blocksize = le32_to_cpu(hdr.blocksize);
+	if (memcmp(hdr.magic, MYFS_IMG_MAGIC, sizeof(hdr.magic)) ||
+	    le32_to_cpu(hdr.version) != MYFS_IMG_VERSION ||
+	    ld->blocksize < MYFS_MIN_BLOCKSIZE || ld->blocksize > MYFS_MAX_BLOCKSIZE ||
+	    !is_power_of_2(ld->blocksize))
+		return -EINVAL;
+	ld->blocksize_bits = ilog2(ld->blocksize);
+
+	ld->bounce = kvmalloc(ld->blocksize, GFP_KERNEL);
+	name = kmalloc(NAME_MAX + 1, GFP_KERNEL);
+	if (!ld->bounce || !name) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	/* the root comes first */
+	err = myfs_img_read(&ld->s, &rec, sizeof(rec));
+	if (err)
+		goto out;
+	if (le16_to_cpu(rec.type) != MYFS_IMG_DIR || !S_ISDIR(le32_to_cpu(rec.mode))) {
+		err = -EINVAL;
+		goto out;
+	}
+	myfs_img_set_attr(d_inode(root), &rec);
+	err = xa_insert(&ld->dentries, le64_to_cpu(rec.ino), root, GFP_KERNEL);
+
+	while (!err) {
+		err = myfs_img_read(&ld->s, &rec, sizeof(rec));
+		if (err)
+			break;
+		if (le16_to_cpu(rec.type) == MYFS_IMG_END)
+			break;
+
+		namelen = le16_to_cpu(rec.namelen);
+		if (namelen > NAME_MAX) {
+			err = -EINVAL;
+			break;
+		}
+		err = myfs_img_read(&ld->s, name, namelen);
+		if (err)
+			break;
+		name[namelen] = '\0';
+		if (strlen(name) != namelen || strchr(name, '/') ||
+		    (name[0] == '.' && (namelen == 1 || (namelen == 2 && name[1] == '.')))) {
+			err = -EINVAL;
+			break;
+		}
+
+		switch (le16_to_cpu(rec.type)) {
+		case MYFS_IMG_DIR:
+		case MYFS_IMG_FILE:
+		case MYFS_IMG_LINK:
+			err = myfs_img_load_inode(ld, &rec, name);
+			break;
+		default:
+			err = -EINVAL;
+		}
+	}
+
+out:
+	kfree(name);
+	kvfree(ld->bounce);
+
+	return err;
+}
+
+/*
+ * Populate a freshly set up mount from its image. A missing image is not an
+ * error, the mount starts empty and the image is created at umount.
+ */
+int myfs_image_load(struct super_block *sb)
+{
+	struct myfs_sb_info *sbi = MYFS_SB(sb);
+	struct myfs_img_load ld = { .sb = sb };
+	int err;
+
+	ld.s.file = filp_open(sbi->image, O_RDONLY | O_LARGEFILE, 0);
+	if (IS_ERR(ld.s.file)) {
+		err = PTR_ERR(ld.s.file);
+		if (err == -ENOENT)
+			return 0;
+		goto out;
+	}
+
+	err = -ENOMEM;
+	ld.s.buf = kvmalloc(MYFS_IMG_CHUNK, GFP_KERNEL);
+	if (ld.s.buf) {
+		xa_init(&ld.dentries);
+		vfs_fadvise(ld.s.file, 0, 0, POSIX_FADV_SEQUENTIAL);
+		err = myfs_img_load_tree(&ld);
+		vfs_fadvise(ld.s.file, 0, 0, POSIX_FADV_DONTNEED);
+		xa_destroy(&ld.dentries);
+		kvfree(ld.s.buf);
+	}
+	filp_close(ld.s.file, NULL);
+
+out:
+	if (err)
+		pr_err("myfs: cannot load image '%s': %d\n", sbi->image, err);
+
+	return err;
+}
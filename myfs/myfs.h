@@ -0,0 +1,371 @@
+#ifndef _MYFS_H
+#define _MYFS_H
+
+#include <linux/fs.h>
+#include <linux/xarray.h>
+#include <linux/percpu.h>
+#include <linux/percpu_counter.h>
+#include <linux/local_lock.h>
+#include <linux/workqueue.h>
+#include <linux/mutex.h>
+#include <linux/shrinker.h>
+#include <linux/sizes.h>
+#include <linux/log2.h>
+
+struct seq_file;
+struct crypto_comp;
+struct myfs_disk;
+struct myfs_extent_map;
+
+#define MYFS_DEFAULT_BLOCKSIZE	SZ_4K
+#define MYFS_MIN_BLOCKSIZE	SZ_4K
+#define MYFS_MAX_BLOCKSIZE	SZ_2M
+#define MYFS_MAGIC		0xbeefcafe
+
+/*
+ * Upper bound for the inline_size module parameter. It has to stay below
+ * the smallest block size, so inline data always fits in block 0.
+ */
+#define MYFS_INLINE_MAX		SZ_2K
+
+/* Free blocks cached per CPU before they go back to the backing allocator. */
+#define MYFS_MAGAZINE_SIZE	32
+
+struct myfs_magazine {
+	local_lock_t lock;
+	unsigned int nr;
+	void *blocks[MYFS_MAGAZINE_SIZE];
+};
+
+struct myfs_pool_stats {
+	u64 allocs;		/* blocks handed out */
+	u64 frees;		/* blocks given back */
+	u64 hits;		/* allocations served from a magazine */
+	u64 refills;		/* magazine refills from the backing allocator */
+	u64 refilled;		/* blocks brought in by those refills */
+	u64 drains;		/* blocks returned to the backing allocator */
+};
+
+struct myfs_block_pool {
+	unsigned int blocksize;
+	unsigned int order;
+	struct kmem_cache *cachep;	/* NULL when blocks come from the page allocator */
+	unsigned int capacity;		/* per-CPU magazine depth, at most MYFS_MAGAZINE_SIZE */
+	struct myfs_magazine __percpu *mags;
+	struct myfs_pool_stats __percpu *stats;
+	atomic_long_t nr_allocated;	/* live blocks, pooled ones included */
+};
+
+enum myfs_io_op {
+	MYFS_OP_READ,
+	MYFS_OP_WRITE,
+	MYFS_NR_OPS,
+};
+
+/*
+ * Compressed blocks sit in the block xarray as tagged pointers to a
+ * struct myfs_compressed. The mark is set on every access to a block and
+ * cleared by the compression worker, which only compresses blocks that
+ * stayed unmarked for a whole pass.
+ */
+#define MYFS_ENTRY_COMPRESSED	1
+#define MYFS_MARK_REFERENCED	XA_MARK_1
+
+/* A swapped out block is an entry holding its slot in the swap file. */
+#define MYFS_ENTRY_SWAPPED	3
+
+/* The entry points at a block that is, or was, shared; see share.c. */
+#define MYFS_MARK_SHARED	XA_MARK_2
+
+/* Set on blocks a running fallocate allocated, so it can give them back. */
+#define MYFS_MARK_FALLOC	XA_MARK_0
+
+/* myfs_get_block() flags */
+#define MYFS_GB_CREATE		0x1	/* allocate a block for a hole */
+#define MYFS_GB_WRITE		0x2	/* the caller modifies the block, unshare it */
+
+#define MYFS_DEFAULT_COMPRESS_AGE	30	/* seconds */
+
+/* Write the mount out to its image= file. */
+#define MYFS_IOC_DUMP		_IO(0xbe, 1)
+
+struct myfs_compressed {
+	struct rcu_head rcu;
+	unsigned int len;
+	char data[];
+};
+
+/* Per-CPU decompression context, as crypto_comp transforms are not shared. */
+struct myfs_comp_stream {
+	local_lock_t lock;
+	struct crypto_comp *tfm;
+};
+
+struct myfs_comp_stats {
+	atomic_long_t nr_compressed;	/* blocks currently compressed */
+	atomic_long_t compressed_bytes;	/* memory they take up */
+	atomic_long_t compressions;
+	atomic_long_t decompressions;
+	atomic_long_t rejected;		/* blocks that did not compress well enough */
+};
+
+struct myfs_share_stats {
+	atomic_long_t nr_shared;	/* blocks with a reference count */
+	atomic_long_t cloned;		/* block references added by reflink */
+	atomic_long_t cow;		/* shared blocks copied on write */
+	atomic_long_t scanned;		/* blocks hashed by the dedup pass */
+	atomic_long_t merged;		/* duplicates replaced by a shared block */
+	atomic_long_t zeroed;		/* all-zero blocks replaced by the zero block */
+};
+
+struct myfs_swap_stats {
+	atomic_long_t nr_swapped;	/* slots in use */
+	atomic_long_t swapouts;
+	atomic_long_t swapins;
+	atomic_long_t errors;		/* failed reads and writes of the swap file */
+};
+
+/* log2(ns) buckets; the last one also counts everything slower. */
+#define MYFS_LAT_BUCKETS	32
+
+struct myfs_io_stats {
+	u64 ops[MYFS_NR_OPS];
+	u64 bytes[MYFS_NR_OPS];
+	u64 latency[MYFS_NR_OPS][MYFS_LAT_BUCKETS];
+	u64 blocks_allocated;
+	u64 blocks_freed;
+	u64 lock_wait_ns;	/* time spent acquiring i_rwsem for writes */
+};
+
+struct myfs_sb_info {
+	unsigned int blocksize;
+	unsigned char blocksize_bits;
+
+	/* size= and nr_inodes= limits, 0 means unlimited */
+	unsigned long long max_bytes;
+	unsigned long max_blocks;
+	unsigned long max_inodes;
+	struct percpu_counter used_blocks;
+	struct percpu_counter used_inodes;
+
+	struct myfs_block_pool pool;
+	struct myfs_io_stats __percpu *stats;
+	struct dentry *debugfs_dir;
+
+	/* compress= tier, NULL algorithm when disabled */
+	char *comp_alg;
+	unsigned int comp_age;
+	struct crypto_comp *comp_tfm;	/* used by comp_work only */
+	void *comp_buf;
+	struct myfs_comp_stream __percpu *comp_streams;
+	struct delayed_work comp_work;
+	struct myfs_comp_stats comp_stats;
+
+	/* reference counts of shared blocks, indexed by block address */
+	struct xarray refs;
+	void *zero_block;
+	unsigned int dedup_interval;	/* seconds between dedup passes, 0 when off */
+	struct delayed_work dedup_work;
+	struct myfs_share_stats share_stats;
+
+	/* swap= backing file for cold blocks */
+	char *swap_path;
+	struct file *swap_file;
+	unsigned long swap_slots;
+	unsigned long *swap_map;	/* slots in use */
+	unsigned long swap_next;	/* where to look for a free slot */
+	spinlock_t swap_lock;
+	struct shrinker swap_shrinker;
+	bool swap_registered;
+	struct myfs_swap_stats swap_stats;
+
+	/* image= file the mount is loaded from and dumped to */
+	char *image;
+	struct mutex image_lock;	/* serializes dumps */
+
+	/* regular files of this mount, for the bulk teardown in kill_sb */
+	spinlock_t inodes_lock;
+	struct list_head inodes;
+
+	/* block device of a myfs_disk mount, NULL when memory-backed */
+	struct myfs_disk *disk;
+};
+
+static inline struct myfs_sb_info *MYFS_SB(struct super_block *sb)
+{
+	return sb->s_fs_info;
+}
+
+/*
+ * used_blocks counts the blocks actually allocated, so a shared block is
+ * accounted once however many files point at it.
+ */
+static inline void myfs_unacct_blocks(struct myfs_sb_info *sbi, long nr)
+{
+	percpu_counter_sub(&sbi->used_blocks, nr);
+	this_cpu_add(sbi->stats->blocks_freed, nr);
+}
+
+/*
+ * The limit is checked against the approximate per-CPU sum, which only
+ * falls back to an exact sum when usage gets close to it.
+ */
+static inline bool myfs_acct_block(struct myfs_sb_info *sbi)
+{
+	if (sbi->max_blocks &&
+	    percpu_counter_compare(&sbi->used_blocks, sbi->max_blocks) >= 0)
+		return false;
+
+	percpu_counter_inc(&sbi->used_blocks);
+	return true;
+}
+
+static inline void myfs_stat_io(struct myfs_sb_info *sbi, enum myfs_io_op op,
+		ssize_t bytes, u64 ns)
+{
+	unsigned int bucket = min_t(unsigned int, ilog2(ns | 1), MYFS_LAT_BUCKETS - 1);
+
+	this_cpu_inc(sbi->stats->ops[op]);
+	if (bytes > 0)
+		this_cpu_add(sbi->stats->bytes[op], bytes);
+	this_cpu_inc(sbi->stats->latency[op][bucket]);
+}
+
+/* myfs_inode_info::flags */
+#define MYFS_I_INLINE		0	/* data lives in inline_data, no blocks yet */
+
+struct myfs_inode_info {
+	struct xarray blocks;	/* block index -> sbi->blocksize buffer */
+	atomic_long_t nr_blocks;
+	struct list_head sb_list;	/* on myfs_sb_info::inodes */
+	unsigned long flags;
+	spinlock_t inline_lock;	/* serializes inline writes with the move to blocks */
+	spinlock_t range_lock;
+	struct rb_root_cached ranges;	/* page ranges of in-place writes in progress */
+	struct rw_semaphore block_rwsem;	/* writepage against block swaps, see myfs_lock_blocks() */
+	struct xarray dir_index;	/* directories: readdir cookie -> dentry */
+	u32 dir_next;		/* next cookie to try */
+	struct myfs_extent_map *extents;	/* myfs_disk: where the data is on disk */
+
+	struct inode vfs_inode;
+
+	/* the inode cache sizes objects to hold inline_size bytes here */
+	char inline_data[];
+};
+
+static inline struct myfs_inode_info *MYFS_I(struct inode *inode)
+{
+	return container_of(inode, struct myfs_inode_info, vfs_inode);
+}
+
+/*
+ * Small regular files start out with their data inside the inode. The flag
+ * is cleared with release semantics once the data has been moved to block
+ * 0, so a reader that no longer sees it also sees the block contents.
+ */
+static inline bool myfs_is_inline(struct inode *inode)
+{
+	return test_bit_acquire(MYFS_I_INLINE, &MYFS_I(inode)->flags);
+}
+
+static inline bool myfs_entry_compressed(void *entry)
+{
+	return xa_pointer_tag(entry) == MYFS_ENTRY_COMPRESSED;
+}
+
+static inline bool myfs_entry_swapped(void *entry)
+{
+	return xa_pointer_tag(entry) == MYFS_ENTRY_SWAPPED;
+}
+
+/* The data is not in a plain block and has to be brought back first. */
+static inline bool myfs_entry_offline(void *entry)
+{
+	return xa_pointer_tag(entry) != 0;
+}
+
+static inline unsigned long myfs_swap_slot(void *entry)
+{
+	return (unsigned long)xa_untag_pointer(entry) >> 2;
+}
+
+static inline void *myfs_swap_entry(unsigned long slot)
+{
+	return xa_tag_pointer((void *)(slot << 2), MYFS_ENTRY_SWAPPED);
+}
+
+/*
+ * Record an access for the compression worker and the swap shrinker; a
+ * no-op without compress= and swap=.
+ */
+static inline void myfs_touch_block(struct myfs_sb_info *sbi,
+		struct myfs_inode_info *info, unsigned long index)
+{
+	if ((sbi->comp_alg || sbi->swap_path) &&
+	    !xa_get_mark(&info->blocks, index, MYFS_MARK_REFERENCED))
+		xa_set_mark(&info->blocks, index, MYFS_MARK_REFERENCED);
+}
+
+/* blockpool.c */
+int myfs_pool_init(struct myfs_block_pool *pool, unsigned int blocksize, const char *name);
+void myfs_pool_destroy(struct myfs_block_pool *pool);
+void *myfs_pool_alloc(struct myfs_block_pool *pool);
+void myfs_pool_free(struct myfs_block_pool *pool, void *block);
+void myfs_pool_release_bulk(struct myfs_block_pool *pool, void **blocks, unsigned int nr);
+void myfs_pool_prefill(struct myfs_block_pool *pool, unsigned int nr);
+void myfs_pool_show(struct seq_file *m, struct myfs_block_pool *pool);
+
+/* compress.c */
+int myfs_compress_init(struct myfs_sb_info *sbi);
+void myfs_compress_exit(struct myfs_sb_info *sbi);
+char *myfs_decompress_block(struct inode *inode, unsigned long index);
+void myfs_free_compressed(struct myfs_sb_info *sbi, void *entry);
+void myfs_compress_show(struct seq_file *m, struct myfs_sb_info *sbi);
+
+/* share.c */
+int myfs_share_init(struct myfs_sb_info *sbi);
+void myfs_share_stop(struct myfs_sb_info *sbi);
+void myfs_share_exit(struct myfs_sb_info *sbi);
+int myfs_block_get(struct myfs_sb_info *sbi, void *block, bool shared);
+bool myfs_block_put(struct myfs_sb_info *sbi, void *block);
+void myfs_free_entry(struct myfs_sb_info *sbi, void *entry, bool shared);
+char *myfs_unshare_block(struct inode *inode, unsigned long index, char *old);
+void myfs_share_show(struct seq_file *m, struct myfs_sb_info *sbi);
+
+/* swap.c */
+int myfs_swap_init(struct super_block *sb);
+void myfs_swap_stop(struct myfs_sb_info *sbi);
+void myfs_swap_exit(struct myfs_sb_info *sbi);
+char *myfs_swap_in(struct inode *inode, unsigned long index);
+void myfs_swap_free(struct myfs_sb_info *sbi, void *entry);
+void myfs_swap_show(struct seq_file *m, struct myfs_sb_info *sbi);
+
+/* image.c */
+int myfs_image_load(struct super_block *sb);
+int myfs_image_dump(struct super_block *sb);
+
+/* disk.c */
+extern struct file_system_type myfs_disk_fs_type;
+
+int myfs_disk_new_inode(struct inode *inode);
+int myfs_disk_fsync_dir(struct file *file, int datasync);
+
+/* super.c */
+extern unsigned int myfs_inline_size;
+extern const struct inode_operations myfs_dir_inode_operations;
+extern const struct file_operations myfs_dir_operations;
+
+struct inode *myfs_alloc_inode(struct super_block *sb);
+void myfs_free_inode(struct inode *inode);
+
+char *myfs_get_block(struct inode *inode, unsigned long index, unsigned int flags);
+int myfs_copy_from_blocks(struct inode *inode, char *dst, loff_t pos, size_t len);
+int myfs_copy_to_blocks(struct inode *inode, const char *src, loff_t pos, size_t len);
+struct inode *myfs_get_inode(struct super_block *sb, const struct inode *dir, int mode);
+int myfs_dir_add(struct inode *dir, struct dentry *dentry);
+bool myfs_lock_blocks(struct inode *inode);
+void myfs_unlock_blocks(struct inode *inode);
+void myfs_for_each_inode(struct myfs_sb_info *sbi,
+		void (*fn)(struct inode *inode, void *arg), void *arg);
+
+#endif /* _MYFS_H */
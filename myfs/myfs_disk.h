@@ -0,0 +1,85 @@
+#ifndef _MYFS_DISK_H
+#define _MYFS_DISK_H
+
+/*
+ * On-disk format of myfs_disk, shared with user/mkfs-myfs.
+ *
+ *	block 0				superblock
+ *	inode_bitmap ...		one bit per inode
+ *	block_bitmap ...		one bit per block of the device
+ *	inode_table ...			MYFS_DISK_INODE_SIZE bytes per inode
+ *	data_start ...			file and directory blocks
+ *
+ * Every region starts on a block boundary and follows the previous one.
+ * The metadata blocks are marked used in the block bitmap, as are the bits
+ * past the end of both bitmaps, and inode 0 is never handed out. All
+ * fields are little endian.
+ */
+
+#include <linux/types.h>
+
+#define MYFS_DISK_MAGIC		0x6d796673	/* "myfs" */
+#define MYFS_DISK_VERSION	1
+#define MYFS_DISK_BLOCKSIZE	4096
+#define MYFS_DISK_INODE_SIZE	256
+#define MYFS_DISK_ROOT_INO	1
+#define MYFS_DISK_EXTENTS	16
+
+struct myfs_disk_super {
+	__le32 magic;
+	__le32 version;
+	__le32 blocksize;
+	__le32 inode_size;
+	__le32 nr_blocks;
+	__le32 nr_inodes;
+	__le32 inode_bitmap;		/* first block of each region */
+	__le32 block_bitmap;
+	__le32 inode_table;
+	__le32 data_start;
+};
+
+/* A run of len blocks of a file starting at lblk, stored from pblk on. */
+struct myfs_disk_extent {
+	__le32 lblk;
+	__le32 pblk;
+	__le32 len;
+};
+
+struct myfs_disk_inode {
+	__le16 mode;
+	__le16 nlink;
+	__le32 uid;
+	__le32 gid;
+	__le32 nr_extents;
+	__le64 size;
+	__le64 atime;
+	__le64 mtime;
+	__le64 ctime;
+	__le32 atime_nsec;
+	__le32 mtime_nsec;
+	__le32 ctime_nsec;
+	__le32 extent_block;		/* holds the extents past the first ones */
+	struct myfs_disk_extent extents[MYFS_DISK_EXTENTS];
+};
+
+/* an extent block is an array of extents, filled up to the inode's nr_extents */
+#define MYFS_DISK_BLOCK_EXTENTS	(MYFS_DISK_BLOCKSIZE / sizeof(struct myfs_disk_extent))
+#define MYFS_DISK_MAX_EXTENTS	(MYFS_DISK_EXTENTS + MYFS_DISK_BLOCK_EXTENTS)
+
+/*
+ * Directories are a sequence of these, each padded to 4 bytes. An entry
+ * never crosses a block boundary, and an inode number of 0 ends the
+ * entries of a block.
+ */
+struct myfs_disk_dirent {
+	__le32 ino;
+	__u8 name_len;
+	__u8 file_type;		/* DT_* */
+	__le16 reserved;
+	char name[];
+};
+
+#define MYFS_DISK_DIRENT_LEN(name_len) \
+	(((unsigned int)sizeof(struct myfs_disk_dirent) + (name_len) + 3) & ~3U)
+
+#endif /* _MYFS_DISK_H */
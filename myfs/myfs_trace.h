@@ -0,0 +1,117 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM myfs
+
+#if !defined(_MYFS_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _MYFS_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/fs.h>
+
+DECLARE_EVENT_CLASS(myfs_io_class,
+	TP_PROTO(struct inode *inode, loff_t pos, size_t count, ssize_t ret),
+	TP_ARGS(inode, pos, count, ret),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(ino_t, ino)
+		__field(loff_t, pos)
+		__field(size_t, count)
+		__field(ssize_t, ret)
+	),
+
+	TP_fast_assign(
+		__entry->dev = inode->i_sb->s_dev;
+		__entry->ino = inode->i_ino;
+		__entry->pos = pos;
+		__entry->count = count;
+		__entry->ret = ret;
+	),
+
+	TP_printk("dev %d:%d ino %lu pos %lld count %zu ret %zd",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  (unsigned long)__entry->ino, __entry->pos,
+		  __entry->count, __entry->ret)
+);
+
+DEFINE_EVENT(myfs_io_class, myfs_read,
+	TP_PROTO(struct inode *inode, loff_t pos, size_t count, ssize_t ret),
+	TP_ARGS(inode, pos, count, ret));
+
+DEFINE_EVENT(myfs_io_class, myfs_write,
+	TP_PROTO(struct inode *inode, loff_t pos, size_t count, ssize_t ret),
+	TP_ARGS(inode, pos, count, ret));
+
+DECLARE_EVENT_CLASS(myfs_range_class,
+	TP_PROTO(struct inode *inode, loff_t pos, loff_t len),
+	TP_ARGS(inode, pos, len),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(ino_t, ino)
+		__field(loff_t, size)
+		__field(loff_t, pos)
+		__field(loff_t, len)
+	),
+
+	TP_fast_assign(
+		__entry->dev = inode->i_sb->s_dev;
+		__entry->ino = inode->i_ino;
+		__entry->size = i_size_read(inode);
+		__entry->pos = pos;
+		__entry->len = len;
+	),
+
+	TP_printk("dev %d:%d ino %lu size %lld pos %lld len %lld",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  (unsigned long)__entry->ino, __entry->size,
+		  __entry->pos, __entry->len)
+);
+
+DEFINE_EVENT(myfs_range_class, myfs_read_folio,
+	TP_PROTO(struct inode *inode, loff_t pos, loff_t len),
+	TP_ARGS(inode, pos, len));
+
+DEFINE_EVENT(myfs_range_class, myfs_writepage,
+	TP_PROTO(struct inode *inode, loff_t pos, loff_t len),
+	TP_ARGS(inode, pos, len));
+
+DEFINE_EVENT(myfs_range_class, myfs_setsize,
+	TP_PROTO(struct inode *inode, loff_t pos, loff_t len),
+	TP_ARGS(inode, pos, len));
+
+DEFINE_EVENT(myfs_range_class, myfs_punch_hole,
+	TP_PROTO(struct inode *inode, loff_t pos, loff_t len),
+	TP_ARGS(inode, pos, len));
+
+DEFINE_EVENT(myfs_range_class, myfs_fallocate,
+	TP_PROTO(struct inode *inode, loff_t pos, loff_t len),
+	TP_ARGS(inode, pos, len));
+
+TRACE_EVENT(myfs_block_alloc,
+	TP_PROTO(struct inode *inode, unsigned long index),
+	TP_ARGS(inode, index),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(ino_t, ino)
+		__field(unsigned long, index)
+	),
+
+	TP_fast_assign(
+		__entry->dev = inode->i_sb->s_dev;
+		__entry->ino = inode->i_ino;
+		__entry->index = index;
+	),
+
+	TP_printk("dev %d:%d ino %lu block %lu",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  (unsigned long)__entry->ino, __entry->index)
+);
+
+#endif /* _MYFS_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE myfs_trace
+#include <trace/define_trace.h>
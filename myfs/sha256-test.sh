@@ -9,3 +9,20 @@ dd if=rnd bs=1M 2>/dev/null | sha256sum
 dd if=rnd bs=10M 2>/dev/null | sha256sum
 dd if=rnd bs=20M 2>/dev/null | sha256sum
 dd if=rnd bs=30M 2>/dev/null | sha256sum
+
+# in-filesystem copy (copy_file_range), including an unaligned range
+cp rnd rnd-copy
+sha256sum rnd-copy
+dd if=rnd of=rnd-part bs=1 skip=12345 count=1000000 iflag=count_bytes,skip_bytes 2>/dev/null
+python3 -c "import os; s=os.open('rnd', os.O_RDONLY); d=os.open('rnd-cfr', os.O_WRONLY|os.O_CREAT|os.O_TRUNC); print(os.copy_file_range(s, d, 1000000, 12345, 0))"
+cmp rnd-part rnd-cfr
+rm -f rnd-copy rnd-part rnd-cfr
+
+# reflink: the clone shares blocks until one side is written
+cp --reflink=always rnd rnd-clone
+cmp rnd rnd-clone
+dd if=/dev/zero of=rnd-clone bs=4K count=1 seek=10 conv=notrunc 2>/dev/null
+dd if=rnd bs=1M 2>/dev/null | sha256sum
+if cmp -s rnd rnd-clone; then exit 1; fi
+rm -f rnd-clone
+cat /sys/kernel/debug/myfs/*/sharing
@@ -0,0 +1,429 @@
+/*
+ * Block sharing: reflink and deduplication.
+ *
+ * A block that more than one xarray entry points at has MYFS_MARK_SHARED
+ * set on each of those entries and a reference count in sbi->refs, indexed
+ * by the block address, with one reference per entry. Unshared blocks have
+ * neither, so files that never share anything pay nothing for it. Shared
+ * blocks are never written in place: a write first copies the block and
+ * drops a reference on the original (myfs_unshare_block).
+ *
+ * Readers look blocks up under RCU without taking a reference, so a shared
+ * block whose last reference goes away is only freed after a grace period.
+ * The all-zero block is shared without a reference count and lives as long
+ * as the mount.
+ *
+ * With dedup=<seconds> a background pass hashes the blocks of every file
+ * and points duplicates at a single shared copy, and all-zero blocks at
+ * the zero block.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/hashtable.h>
+#include <linux/xxhash.h>
+#include <linux/seq_file.h>
+
+#include "myfs.h"
+
+#define MYFS_DEDUP_HASH_BITS		14
+#define MYFS_DEDUP_MAX_CANDIDATES	(1 << 16)
+
+static unsigned long myfs_ref_key(void *block)
+{
+	return (unsigned long)block >> PAGE_SHIFT;
+}
+
+/*
+ * Take a reference on @block for a new entry pointing at it. An unshared
+ * block goes to two references, its current owner and the new entry; for a
+ * @shared one the caller must be sure it is still alive, or handle -ENOENT.
+ */
+int myfs_block_get(struct myfs_sb_info *sbi, void *block, bool shared)
+{
+	unsigned long key = myfs_ref_key(block);
+	void *cur, *old;
+
+	if (block == sbi->zero_block)
+		return 0;
+
+	cur = xa_load(&sbi->refs, key);
+	for (;;) {
+		if (shared != !!cur)
+			return shared ? -ENOENT : -EEXIST;
+
+		old = xa_cmpxchg(&sbi->refs, key, cur,
+				 xa_mk_value(cur ? xa_to_value(cur) + 1 : 2), GFP_NOFS);
+		if (old == cur)
+			break;
+		if (xa_is_err(old))
+			return xa_err(old);
+		cur = old;
+	}
+
+	if (!cur)
+		atomic_long_inc(&sbi->share_stats.nr_shared);
+
+	return 0;
+}
+
+/* Returns true when the last reference is gone and @block has to be freed. */
+bool myfs_block_put(struct myfs_sb_info *sbi, void *block)
+{
+	unsigned long key = myfs_ref_key(block);
+	unsigned long count;
+	void *cur, *old;
+
+	if (block == sbi->zero_block)
+		return false;
+
+	cur = xa_load(&sbi->refs, key);
+	for (;;) {
+		if (WARN_ON_ONCE(!cur))
+			return false;
+
+		count = xa_to_value(cur);
+		old = xa_cmpxchg(&sbi->refs, key, cur,
+				 count > 1 ? xa_mk_value(count - 1) : NULL, GFP_NOFS);
+		if (old == cur)
+			break;
+		cur = old;
+	}
+
+	if (count > 1)
+		return false;
+
+	atomic_long_dec(&sbi->share_stats.nr_shared);
+	return true;
+}
+
+struct myfs_rcu_block {
+	struct rcu_head rcu;
+	struct myfs_block_pool *pool;
+	void *block;
+};
+
+/* Runs in softirq context, so the block bypasses the per-CPU magazines. */
+static void myfs_free_block_rcu(struct rcu_head *head)
+{
+	struct myfs_rcu_block *rb = container_of(head, struct myfs_rcu_block, rcu);
+
+	myfs_pool_release_bulk(rb->pool, &rb->block, 1);
+	kfree(rb);
+}
+
+static void myfs_free_block_deferred(struct myfs_sb_info *sbi, void *block)
+{
+	struct myfs_rcu_block *rb;
+
+	rb = kmalloc(sizeof(*rb), GFP_NOFS | __GFP_NOWARN);
+	if (!rb) {
+		synchronize_rcu();
+		myfs_pool_free(&sbi->pool, block);
+		return;
+	}
+
+	rb->pool = &sbi->pool;
+	rb->block = block;
+	call_rcu(&rb->rcu, myfs_free_block_rcu);
+}
+
+/*
+ * Release an entry that has been removed from an inode's xarray. Callers
+ * keep readers of that inode away, so an unshared block goes straight back
+ * to the pool; a shared one goes only with its last reference.
+ */
+void myfs_free_entry(struct myfs_sb_info *sbi, void *entry, bool shared)
+{
+	if (myfs_entry_compressed(entry))
+		myfs_free_compressed(sbi, entry);
+	else if (myfs_entry_swapped(entry))
+		myfs_swap_free(sbi, entry);
+	else if (!shared)
+		myfs_pool_free(&sbi->pool, entry);
+	else if (myfs_block_put(sbi, entry))
+		myfs_free_block_deferred(sbi, entry);
+	else
+		return;
+
+	myfs_unacct_blocks(sbi, 1);
+}
+
+/*
+ * Give @inode its own copy of the shared block @old at @index before it
+ * is modified. A racing writer of the same block may get there first, in
+ * which case its copy is used.
+ */
+char *myfs_unshare_block(struct inode *inode, unsigned long index, char *old)
+{
+	struct myfs_inode_info *info = MYFS_I(inode);
+	struct myfs_sb_info *sbi = MYFS_SB(inode->i_sb);
+	char *block, *cur;
+
+	if (!myfs_acct_block(sbi))
+		return ERR_PTR(-ENOSPC);
+
+	block = myfs_pool_alloc(&sbi->pool);
+	if (!block) {
+		percpu_counter_dec(&sbi->used_blocks);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	rcu_read_lock();
+	cur = xa_load(&info->blocks, index);
+	if (cur == old)
+		memcpy(block, old, sbi->blocksize);
+	rcu_read_unlock();
+
+	if (cur == old) {
+		xa_lock(&info->blocks);
+		cur = __xa_cmpxchg(&info->blocks, index, old, block, GFP_NOFS);
+		if (cur == old)
+			__xa_clear_mark(&info->blocks, index, MYFS_MARK_SHARED);
+		xa_unlock(&info->blocks);
+	}
+
+	if (cur != old) {
+		myfs_pool_free(&sbi->pool, block);
+		percpu_counter_dec(&sbi->used_blocks);
+		return xa_is_err(cur) ? ERR_PTR(xa_err(cur)) : cur;
+	}
+
+	this_cpu_inc(sbi->stats->blocks_allocated);
+	atomic_long_inc(&sbi->share_stats.cow);
+	myfs_free_entry(sbi, old, true);
+
+	return block;
+}
+
+struct myfs_dedup_cand {
+	struct hlist_node node;
+	u64 hash;
+	struct inode *inode;	/* owner of the block, pinned with igrab */
+	unsigned long index;
+	void *block;
+	bool shared;
+};
+
+struct myfs_dedup {
+	struct myfs_sb_info *sbi;
+	unsigned int nr;
+	DECLARE_HASHTABLE(table, MYFS_DEDUP_HASH_BITS);
+};
+
+/* Point @index at @block, which the caller holds a reference on for it. */
+static void myfs_dedup_replace(struct inode *inode, unsigned long index,
+		void *old, bool shared, void *block)
+{
+	struct myfs_inode_info *info = MYFS_I(inode);
+
+	xa_lock(&info->blocks);
+	__xa_store(&info->blocks, index, block, GFP_ATOMIC);
+	__xa_set_mark(&info->blocks, index, MYFS_MARK_SHARED);
+	xa_unlock(&info->blocks);
+
+	myfs_free_entry(MYFS_SB(inode->i_sb), old, shared);
+}
+
+/*
+ * Try to replace @entry at @index of @inode with the candidate's block. An
+ * unshared candidate can only be shared with its owner locked, which is
+ * only tried, since the current inode is locked already.
+ */
+static bool myfs_dedup_merge(struct myfs_dedup *d, struct myfs_dedup_cand *cand,
+		struct inode *inode, unsigned long index, void *entry, bool shared)
+{
+	struct myfs_sb_info *sbi = d->sbi;
+	struct inode *owner = cand->inode;
+	struct xarray *blocks = &MYFS_I(owner)->blocks;
+	bool locked = false, merged = false;
+
+	if (cand->shared) {
+		if (myfs_block_get(sbi, cand->block, true))
+			return false;
+		if (memcmp(cand->block, entry, sbi->blocksize)) {
+			if (myfs_block_put(sbi, cand->block)) {
+				myfs_free_block_deferred(sbi, cand->block);
+				myfs_unacct_blocks(sbi, 1);
+			}
+			return false;
+		}
+		myfs_dedup_replace(inode, index, entry, shared, cand->block);
+		return true;
+	}
+
+	if (owner != inode) {
+		if (!myfs_lock_blocks(owner))
+			return false;
+		locked = true;
+	}
+
+	if (xa_load(blocks, cand->index) != cand->block ||
+	    memcmp(cand->block, entry, sbi->blocksize) ||
+	    myfs_block_get(sbi, cand->block, xa_get_mark(blocks, cand->index, MYFS_MARK_SHARED)))
+		goto out;
+
+	xa_set_mark(blocks, cand->index, MYFS_MARK_SHARED);
+	cand->shared = true;
+	myfs_dedup_replace(inode, index, entry, shared, cand->block);
+	merged = true;
+
+out:
+	if (locked)
+		myfs_unlock_blocks(owner);
+	return merged;
+}
+
+static void myfs_dedup_add(struct myfs_dedup *d, u64 hash, struct inode *inode,
+		unsigned long index, void *block, bool shared)
+{
+	struct myfs_dedup_cand *cand;
+
+	if (d->nr >= MYFS_DEDUP_MAX_CANDIDATES)
+		return;
+
+	cand = kmalloc(sizeof(*cand), GFP_KERNEL | __GFP_NOWARN);
+	if (!cand)
+		return;
+
+	cand->inode = igrab(inode);
+	if (!cand->inode) {
+		kfree(cand);
+		return;
+	}
+	cand->hash = hash;
+	cand->index = index;
+	cand->block = block;
+	cand->shared = shared;
+	hash_add(d->table, &cand->node, hash);
+	d->nr++;
+}
+
+static void myfs_dedup_inode(struct inode *inode, void *arg)
+{
+	struct myfs_dedup *d = arg;
+	struct myfs_sb_info *sbi = d->sbi;
+	struct myfs_inode_info *info = MYFS_I(inode);
+	struct myfs_dedup_cand *cand;
+	unsigned long index;
+	bool shared, merged;
+	void *entry;
+	u64 hash;
+
+	if (!myfs_lock_blocks(inode))
+		return;
+
+	xa_for_each(&info->blocks, index, entry) {
+		if (myfs_entry_offline(entry) || entry == sbi->zero_block)
+			continue;
+
+		shared = xa_get_mark(&info->blocks, index, MYFS_MARK_SHARED);
+		atomic_long_inc(&sbi->share_stats.scanned);
+
+		if (!memchr_inv(entry, 0, sbi->blocksize)) {
+			myfs_dedup_replace(inode, index, entry, shared, sbi->zero_block);
+			atomic_long_inc(&sbi->share_stats.zeroed);
+			continue;
+		}
+
+		hash = xxh64(entry, sbi->blocksize, 0);
+		merged = false;
+		hash_for_each_possible(d->table, cand, node, hash) {
+			if (cand->hash != hash || cand->block == entry)
+				continue;
+			merged = myfs_dedup_merge(d, cand, inode, index, entry, shared);
+			if (merged)
+				break;
+		}
+
+		if (merged)
+			atomic_long_inc(&sbi->share_stats.merged);
+		else
+			myfs_dedup_add(d, hash, inode, index, entry, shared);
+
+		cond_resched();
+	}
+
+	myfs_unlock_blocks(inode);
+}
+
+static void myfs_dedup_work(struct work_struct *work)
+{
+	struct myfs_sb_info *sbi = container_of(to_delayed_work(work),
+						struct myfs_sb_info, dedup_work);
+	struct myfs_dedup_cand *cand;
+	struct hlist_node *tmp;
+	struct myfs_dedup *d;
+	int bkt;
+
+	d = kvmalloc(sizeof(*d), GFP_KERNEL);
+	if (d) {
+		d->sbi = sbi;
+		d->nr = 0;
+		hash_init(d->table);
+
+		myfs_for_each_inode(sbi, myfs_dedup_inode, d);
+
+		hash_for_each_safe(d->table, bkt, tmp, cand, node) {
+			iput(cand->inode);
+			kfree(cand);
+		}
+		kvfree(d);
+	}
+
+	queue_delayed_work(system_unbound_wq, &sbi->dedup_work, sbi->dedup_interval * HZ);
+}
+
+void myfs_share_show(struct seq_file *m, struct myfs_sb_info *sbi)
+{
+	struct myfs_share_stats *stats = &sbi->share_stats;
+
+	seq_printf(m, "dedup_interval: %u\n", sbi->dedup_interval);
+	seq_printf(m, "shared_blocks:  %ld\n", atomic_long_read(&stats->nr_shared));
+	seq_printf(m, "cloned:         %ld\n", atomic_long_read(&stats->cloned));
+	seq_printf(m, "cow:            %ld\n", atomic_long_read(&stats->cow));
+	seq_printf(m, "scanned:        %ld\n", atomic_long_read(&stats->scanned));
+	seq_printf(m, "merged:         %ld\n", atomic_long_read(&stats->merged));
+	seq_printf(m, "zeroed:         %ld\n", atomic_long_read(&stats->zeroed));
+}
+
+int myfs_share_init(struct myfs_sb_info *sbi)
+{
+	xa_init(&sbi->refs);
+
+	sbi->zero_block = myfs_pool_alloc(&sbi->pool);
+	if (!sbi->zero_block)
+		return -ENOMEM;
+
+	if (sbi->dedup_interval) {
+		INIT_DELAYED_WORK(&sbi->dedup_work, myfs_dedup_work);
+		queue_delayed_work(system_unbound_wq, &sbi->dedup_work,
+				   sbi->dedup_interval * HZ);
+	}
+
+	return 0;
+}
+
+/* Called before the storage is torn down, so no pass runs during umount. */
+void myfs_share_stop(struct myfs_sb_info *sbi)
+{
+	if (sbi->dedup_interval && sbi->zero_block)
+		cancel_delayed_work_sync(&sbi->dedup_work);
+}
+
+/* Called once every file is gone and only deferred frees may be pending. */
+void myfs_share_exit(struct myfs_sb_info *sbi)
+{
+	if (!sbi->zero_block)
+		return;
+
+	rcu_barrier();
+
+	WARN_ON(!xa_empty(&sbi->refs));
+	xa_destroy(&sbi->refs);
+
+	myfs_pool_free(&sbi->pool, sbi->zero_block);
+	sbi->zero_block = NULL;
+}
@@ -0,0 +1,2392 @@
+/*
+ * SO2 Lab - Filesystem drivers
+ * Exercise #1 (no-dev filesystem)
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/pagemap.h>
+#include <linux/slab.h>
+#include <linux/highmem.h>
+#include <linux/writeback.h>
+#include <linux/backing-dev.h>
+#include <linux/parser.h>
+#include <linux/seq_file.h>
+#include <linux/log2.h>
+#include <linux/debugfs.h>
+#include <linux/falloc.h>
+#include <linux/ktime.h>
+#include <linux/statfs.h>
+#include <linux/mm.h>
+#include <linux/uio.h>
+#include <linux/bvec.h>
+#include <linux/interval_tree_generic.h>
+
+#include "myfs.h"
+
+#define CREATE_TRACE_POINTS
+#include "myfs_trace.h"
+
+MODULE_DESCRIPTION("Simple no-dev filesystem");
+MODULE_AUTHOR("SO2");
+MODULE_LICENSE("GPL");
+
+#define LOG_LEVEL		KERN_ALERT
+
+#define EOF 0
+
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
+#define MIN(x, y) (((x) > (y)) ? (y) : (x))
+
+/* declarations of functions that are part of operation structures */
+
+static struct kmem_cache *myfs_inode_cachep;
+static struct dentry *myfs_debugfs_root;
+
+unsigned int myfs_inline_size = 128;
+module_param_named(inline_size, myfs_inline_size, uint, 0444);
+MODULE_PARM_DESC(inline_size, "Files up to this many bytes are stored in the inode (0 disables, max 2048)");
+
+static int myfs_mknod(struct user_namespace *user_ns, struct inode *dir,
+		struct dentry *dentry, umode_t mode, dev_t dev);
+static int myfs_create(struct user_namespace *user_ns, struct inode *dir, struct dentry *dentry,
+		umode_t mode, bool excl);
+static int myfs_mkdir(struct user_namespace *user_ns, struct inode *dir, struct dentry *dentry, umode_t mode);
+static int myfs_link(struct dentry *old_dentry, struct inode *dir, struct dentry *dentry);
+static int myfs_unlink(struct inode *dir, struct dentry *dentry);
+static int myfs_rmdir(struct inode *dir, struct dentry *dentry);
+static int myfs_rename(struct user_namespace *user_ns, struct inode *old_dir,
+		struct dentry *old_dentry, struct inode *new_dir, struct dentry *new_dentry,
+		unsigned int flags);
+static int myfs_readdir(struct file *file, struct dir_context *ctx);
+static loff_t myfs_dir_llseek(struct file *file, loff_t offset, int whence);
+
+static int myfs_read_folio(struct file *file, struct folio *folio);
+static int myfs_writepage(struct page *page, struct writeback_control *wbc);
+static int myfs_write_begin(struct file *file, struct address_space *mapping,
+		loff_t pos, unsigned len, struct page **pagep, void **fsdata);
+static int myfs_write_end(struct file *file, struct address_space *mapping,
+		loff_t pos, unsigned len, unsigned copied, struct page *page, void *fsdata);
+static ssize_t myfs_direct_IO(struct kiocb *iocb, struct iov_iter *iter);
+static int myfs_fsync(struct file *file, loff_t start, loff_t end, int datasync);
+static int myfs_dir_fsync(struct file *file, loff_t start, loff_t end, int datasync);
+int myfs_setattr(struct user_namespace *, struct dentry *dentry, struct iattr *iattr);
+static void myfs_evict_inode(struct inode *inode);
+static ssize_t myfs_file_read_iter(struct kiocb *iocb, struct iov_iter *to);
+static ssize_t myfs_file_write_iter(struct kiocb *iocb, struct iov_iter *from);
+static loff_t myfs_file_llseek(struct file *file, loff_t offset, int whence);
+static long myfs_fallocate(struct file *file, int mode, loff_t offset, loff_t len);
+static ssize_t myfs_copy_file_range(struct file *file_in, loff_t pos_in,
+		struct file *file_out, loff_t pos_out, size_t len, unsigned int flags);
+static loff_t myfs_remap_file_range(struct file *file_in, loff_t pos_in,
+		struct file *file_out, loff_t pos_out, loff_t len, unsigned int remap_flags);
+static long myfs_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
+static int myfs_show_options(struct seq_file *m, struct dentry *root);
+static int myfs_statfs(struct dentry *dentry, struct kstatfs *buf);
+
+/* TODO 2/4: define super_operations structure */
+static const struct super_operations myfs_ops = {
+	.alloc_inode	= myfs_alloc_inode,
+	.evict_inode	= myfs_evict_inode,
+	.free_inode	= myfs_free_inode,
+	.statfs		= myfs_statfs,
+	.drop_inode	= generic_drop_inode,
+	.show_options	= myfs_show_options,
+};
+
+const struct inode_operations myfs_dir_inode_operations = {
+	/* TODO 5/8: Fill dir inode operations structure. */
+	.create         = myfs_create,
+	.lookup         = simple_lookup,
+	.link           = myfs_link,
+	.unlink         = myfs_unlink,
+	.mkdir          = myfs_mkdir,
+	.rmdir          = myfs_rmdir,
+	.mknod          = myfs_mknod,
+	.rename         = myfs_rename,
+};
+
+const struct file_operations myfs_dir_operations = {
+	.llseek		= myfs_dir_llseek,
+	.read		= generic_read_dir,
+	.iterate_shared	= myfs_readdir,
+	.fsync		= myfs_dir_fsync,
+	.unlocked_ioctl	= myfs_ioctl,
+	.compat_ioctl	= compat_ptr_ioctl,
+};
+
+/*
+ * File data goes through the page cache; the per-inode blocks are the
+ * backing store that folios are filled from and written back to.
+ */
+static const struct address_space_operations myfs_aops = {
+	.read_folio     = myfs_read_folio,
+	.writepage      = myfs_writepage,
+	.write_begin    = myfs_write_begin,
+	.write_end      = myfs_write_end,
+	.direct_IO      = myfs_direct_IO,
+	.dirty_folio    = filemap_dirty_folio,
+};
+
+static const struct file_operations myfs_file_operations = {
+	/* TODO 6/4: Fill file operations structure. */
+	.read_iter      = myfs_file_read_iter,
+	.write_iter     = myfs_file_write_iter,
+	.mmap           = generic_file_mmap,
+	.llseek         = myfs_file_llseek,
+	.fsync          = myfs_fsync,
+	.fallocate      = myfs_fallocate,
+	.splice_read    = generic_file_splice_read,
+	.splice_write   = iter_file_splice_write,
+	.copy_file_range = myfs_copy_file_range,
+	.remap_file_range = myfs_remap_file_range,
+	.unlocked_ioctl = myfs_ioctl,
+	.compat_ioctl   = compat_ptr_ioctl,
+};
+
+static const struct inode_operations myfs_file_inode_operations = {
+	/* TODO 6/1: Fill file inode operations structure. */
+	.getattr        = simple_getattr,
+	.setattr        = myfs_setattr,
+};
+
+struct inode *myfs_alloc_inode(struct super_block *sb)
+{
+	struct myfs_inode_info *info;
+
+	info = alloc_inode_sb(sb, myfs_inode_cachep, GFP_KERNEL);
+	if (!info)
+		return NULL;
+
+	xa_init(&info->blocks);
+	atomic_long_set(&info->nr_blocks, 0);
+	INIT_LIST_HEAD(&info->sb_list);
+	info->flags = 0;
+	xa_init_flags(&info->dir_index, XA_FLAGS_ALLOC);
+	info->dir_next = 0;
+	info->extents = NULL;
+
+	return &info->vfs_inode;
+}
+
+/*
+ * Blocks go back to the superblock's pool here rather than in free_inode,
+ * which runs after an RCU grace period when the superblock may be gone.
+ */
+static void myfs_evict_inode(struct inode *inode)
+{
+	struct myfs_inode_info *info = MYFS_I(inode);
+	struct myfs_sb_info *sbi = MYFS_SB(inode->i_sb);
+	unsigned long index;
+	char *block;
+
+	truncate_inode_pages_final(&inode->i_data);
+	clear_inode(inode);
+
+	spin_lock(&sbi->inodes_lock);
+	list_del_init(&info->sb_list);
+	spin_unlock(&sbi->inodes_lock);
+
+	xa_for_each(&info->blocks, index, block) {
+		myfs_free_entry(sbi, block,
+				xa_get_mark(&info->blocks, index, MYFS_MARK_SHARED));
+	}
+	xa_destroy(&info->blocks);
+	xa_destroy(&info->dir_index);
+	atomic_long_set(&info->nr_blocks, 0);
+	percpu_counter_dec(&sbi->used_inodes);
+}
+
+void myfs_free_inode(struct inode *inode)
+{
+	kmem_cache_free(myfs_inode_cachep, MYFS_I(inode));
+}
+
+static void myfs_inode_init_once(void *data)
+{
+	struct myfs_inode_info *info = data;
+
+	spin_lock_init(&info->inline_lock);
+	spin_lock_init(&info->range_lock);
+	info->ranges = RB_ROOT_CACHED;
+	init_rwsem(&info->block_rwsem);
+	inode_init_once(&info->vfs_inode);
+}
+
+static bool myfs_read_inline(struct inode *inode, char *dst, loff_t pos, size_t len)
+{
+	struct myfs_inode_info *info = MYFS_I(inode);
+	size_t chunk = 0;
+
+	spin_lock(&info->inline_lock);
+	if (!test_bit(MYFS_I_INLINE, &info->flags)) {
+		spin_unlock(&info->inline_lock);
+		return false;
+	}
+	if (pos < myfs_inline_size) {
+		chunk = MIN(len, myfs_inline_size - pos);
+		memcpy(dst, info->inline_data + pos, chunk);
+	}
+	spin_unlock(&info->inline_lock);
+
+	memset(dst + chunk, 0, len - chunk);
+
+	return true;
+}
+
+/*
+ * Lookups are lockless; racing allocations of the same block are resolved
+ * by the cmpxchg, and the loser frees its buffer.
+ *
+ * Returns NULL for a hole without MYFS_GB_CREATE, and an ERR_PTR when a new
+ * block cannot be allocated, a compressed one cannot be decompressed or a
+ * shared one cannot be copied for MYFS_GB_WRITE.
+ */
+char *myfs_get_block(struct inode *inode, unsigned long index, unsigned int flags)
+{
+	struct myfs_inode_info *info = MYFS_I(inode);
+	struct myfs_sb_info *sbi = MYFS_SB(inode->i_sb);
+	char *block, *old;
+
+	block = xa_load(&info->blocks, index);
+	if (myfs_entry_compressed(block))
+		block = myfs_decompress_block(inode, index);
+	else if (myfs_entry_swapped(block))
+		block = myfs_swap_in(inode, index);
+	if (block && !IS_ERR(block)) {
+		if ((flags & MYFS_GB_WRITE) &&
+		    xa_get_mark(&info->blocks, index, MYFS_MARK_SHARED))
+			block = myfs_unshare_block(inode, index, block);
+		myfs_touch_block(sbi, info, index);
+	}
+	if (block || !(flags & MYFS_GB_CREATE))
+		return block;
+
+	if (!myfs_acct_block(sbi))
+		return ERR_PTR(-ENOSPC);
+
+	block = myfs_pool_alloc(&sbi->pool);
+	if (!block) {
+		percpu_counter_dec(&sbi->used_blocks);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	old = xa_cmpxchg(&info->blocks, index, NULL, block, GFP_NOFS);
+	if (old) {
+		myfs_pool_free(&sbi->pool, block);
+		percpu_counter_dec(&sbi->used_blocks);
+		return xa_is_err(old) ? ERR_PTR(xa_err(old)) : old;
+	}
+	atomic_long_inc(&info->nr_blocks);
+	inode_add_bytes(inode, sbi->blocksize);
+	this_cpu_inc(sbi->stats->blocks_allocated);
+	myfs_touch_block(sbi, info, index);
+	trace_myfs_block_alloc(inode, index);
+
+	return block;
+}
+
+/*
+ * Zero the byte range [start, end) of the file's blocks and give every
+ * block that falls entirely inside it back to the pool, leaving a hole.
+ *
+ * Callers hold the invalidate lock exclusively and have already dropped the
+ * range from the page cache, so nothing can be reading these blocks.
+ */
+static int myfs_punch_blocks(struct inode *inode, loff_t start, loff_t end)
+{
+	struct myfs_inode_info *info = MYFS_I(inode);
+	struct myfs_sb_info *sbi = MYFS_SB(inode->i_sb);
+	unsigned long first = DIV_ROUND_UP(start, sbi->blocksize);
+	unsigned long last = end >> sbi->blocksize_bits;
+	unsigned long index;
+	size_t offset;
+	char *block;
+	bool shared;
+
+	if (start >= end)
+		return 0;
+
+	if (myfs_is_inline(inode)) {
+		spin_lock(&info->inline_lock);
+		if (test_bit(MYFS_I_INLINE, &info->flags)) {
+			if (start < myfs_inline_size)
+				memset(info->inline_data + start, 0,
+				       MIN(end, (loff_t)myfs_inline_size) - start);
+			spin_unlock(&info->inline_lock);
+			return 0;
+		}
+		spin_unlock(&info->inline_lock);
+	}
+
+	offset = start & (sbi->blocksize - 1);
+	if (offset) {
+		block = myfs_get_block(inode, start >> sbi->blocksize_bits, MYFS_GB_WRITE);
+		if (IS_ERR(block))
+			return PTR_ERR(block);
+		if (block)
+			memset(block + offset, 0,
+			       MIN(end - start, sbi->blocksize - offset));
+	}
+
+	offset = end & (sbi->blocksize - 1);
+	if (offset && last >= first) {
+		block = myfs_get_block(inode, last, MYFS_GB_WRITE);
+		if (IS_ERR(block))
+			return PTR_ERR(block);
+		if (block)
+			memset(block, 0, offset);
+	}
+
+	if (first >= last)
+		return 0;
+
+	xa_for_each_range(&info->blocks, index, block, first, last - 1) {
+		shared = xa_get_mark(&info->blocks, index, MYFS_MARK_SHARED);
+		xa_erase(&info->blocks, index);
+		myfs_free_entry(sbi, block, shared);
+		atomic_long_dec(&info->nr_blocks);
+		inode_sub_bytes(inode, sbi->blocksize);
+	}
+
+	return 0;
+}
+
+/* Move inline data into block 0; the inode keeps using blocks from then on. */
+static int myfs_convert_inline(struct inode *inode)
+{
+	struct myfs_inode_info *info = MYFS_I(inode);
+	char *block;
+
+	if (!myfs_is_inline(inode))
+		return 0;
+
+	block = myfs_get_block(inode, 0, MYFS_GB_CREATE | MYFS_GB_WRITE);
+	if (IS_ERR(block))
+		return PTR_ERR(block);
+
+	spin_lock(&info->inline_lock);
+	if (test_bit(MYFS_I_INLINE, &info->flags)) {
+		memcpy(block, info->inline_data, myfs_inline_size);
+		clear_bit_unlock(MYFS_I_INLINE, &info->flags);
+	}
+	spin_unlock(&info->inline_lock);
+
+	return 0;
+}
+
+/*
+ * Returns 1 when the write went to inline data, 0 when the caller has to
+ * write to blocks, and an error if the inline data could not be moved.
+ */
+static int myfs_write_inline(struct inode *inode, const char *src, loff_t pos, size_t len)
+{
+	struct myfs_inode_info *info = MYFS_I(inode);
+	int ret = 0;
+
+	if (pos + len > myfs_inline_size)
+		return myfs_convert_inline(inode);
+
+	spin_lock(&info->inline_lock);
+	if (test_bit(MYFS_I_INLINE, &info->flags)) {
+		memcpy(info->inline_data + pos, src, len);
+		ret = 1;
+	}
+	spin_unlock(&info->inline_lock);
+
+	return ret;
+}
+
+/*
+ * Copy @len bytes at @offset of block @index to @dst, zeroes for a hole.
+ * Another file may drop the last reference on a shared block at any time,
+ * so the block is only dereferenced under RCU; compressed blocks have to
+ * be decompressed first and take the slow path.
+ */
+static int myfs_read_block(struct inode *inode, unsigned long index,
+		char *dst, size_t offset, size_t len)
+{
+	struct myfs_inode_info *info = MYFS_I(inode);
+	struct myfs_sb_info *sbi = MYFS_SB(inode->i_sb);
+	char *block;
+
+	rcu_read_lock();
+	block = xa_load(&info->blocks, index);
+	if (!myfs_entry_offline(block)) {
+		if (block)
+			memcpy(dst, block + offset, len);
+		else
+			memset(dst, 0, len);
+		rcu_read_unlock();
+
+		if (block)
+			myfs_touch_block(sbi, info, index);
+		return 0;
+	}
+	rcu_read_unlock();
+
+	block = myfs_get_block(inode, index, 0);
+	if (IS_ERR(block))
+		return PTR_ERR(block);
+	if (block)
+		memcpy(dst, block + offset, len);
+	else
+		memset(dst, 0, len);
+
+	return 0;
+}
+
+int myfs_copy_from_blocks(struct inode *inode, char *dst, loff_t pos, size_t len)
+{
+	struct myfs_sb_info *sbi = MYFS_SB(inode->i_sb);
+	size_t offset, chunk;
+	int ret;
+
+	if (myfs_is_inline(inode) && myfs_read_inline(inode, dst, pos, len))
+		return 0;
+
+	while (len) {
+		offset = pos & (sbi->blocksize - 1);
+		chunk = MIN(len, sbi->blocksize - offset);
+
+		ret = myfs_read_block(inode, pos >> sbi->blocksize_bits, dst, offset, chunk);
+		if (ret)
+			return ret;
+
+		dst += chunk;
+		pos += chunk;
+		len -= chunk;
+	}
+
+	return 0;
+}
+
+int myfs_copy_to_blocks(struct inode *inode, const char *src, loff_t pos, size_t len)
+{
+	struct myfs_sb_info *sbi = MYFS_SB(inode->i_sb);
+	size_t offset, chunk;
+	char *block;
+	int ret;
+
+	if (myfs_is_inline(inode)) {
+		ret = myfs_write_inline(inode, src, pos, len);
+		if (ret)
+			return ret < 0 ? ret : 0;
+	}
+
+	while (len) {
+		offset = pos & (sbi->blocksize - 1);
+		chunk = MIN(len, sbi->blocksize - offset);
+
+		block = myfs_get_block(inode, pos >> sbi->blocksize_bits,
+				       MYFS_GB_CREATE | MYFS_GB_WRITE);
+		if (IS_ERR(block))
+			return PTR_ERR(block);
+		memcpy(block + offset, src, chunk);
+
+		src += chunk;
+		pos += chunk;
+		len -= chunk;
+	}
+
+	return 0;
+}
+
+/* Fill a single page of the file at @pos from the block store. */
+static int myfs_fill_page(struct inode *inode, struct page *page, loff_t pos)
+{
+	loff_t isize = i_size_read(inode);
+	size_t len = 0;
+	char *kaddr;
+	int ret = 0;
+
+	if (pos < isize)
+		len = MIN(isize - pos, PAGE_SIZE);
+
+	kaddr = kmap_local_page(page);
+	if (len)
+		ret = myfs_copy_from_blocks(inode, kaddr, pos, len);
+	memset(kaddr + len, 0, PAGE_SIZE - len);
+	kunmap_local(kaddr);
+
+	return ret;
+}
+
+/* Fill every page of a locked @folio and mark it uptodate. */
+static int myfs_fill_folio(struct inode *inode, struct folio *folio)
+{
+	loff_t pos = folio_pos(folio);
+	long i;
+	int ret;
+
+	for (i = 0; i < folio_nr_pages(folio); i++) {
+		ret = myfs_fill_page(inode, folio_page(folio, i), pos + i * PAGE_SIZE);
+		if (ret)
+			return ret;
+	}
+
+	flush_dcache_folio(folio);
+	folio_mark_uptodate(folio);
+
+	return 0;
+}
+
+static int myfs_read_folio(struct file *file, struct folio *folio)
+{
+	struct inode *inode = folio->mapping->host;
+	int ret;
+
+	trace_myfs_read_folio(inode, folio_pos(folio), folio_size(folio));
+
+	ret = myfs_fill_folio(inode, folio);
+	folio_unlock(folio);
+
+	return ret;
+}
+
+/* Pages dirtied through mmap land in the block store here. */
+static int myfs_writepage(struct page *page, struct writeback_control *wbc)
+{
+	struct folio *folio = page_folio(page);
+	struct inode *inode = folio->mapping->host;
+	struct myfs_inode_info *info = MYFS_I(inode);
+	loff_t isize = i_size_read(inode);
+	loff_t pos = folio_pos(folio);
+	size_t len;
+	char *kaddr;
+	long i;
+	int ret = 0;
+
+	trace_myfs_writepage(inode, pos, folio_size(folio));
+
+	/*
+	 * Compression, swap, reflink and dedup swap blocks under block_rwsem
+	 * and never wait for a folio while they hold it, so data integrity
+	 * writeback can wait for them. Reclaim only tries.
+	 */
+	if (wbc->sync_mode == WB_SYNC_ALL) {
+		down_read(&info->block_rwsem);
+	} else if (!down_read_trylock(&info->block_rwsem)) {
+		folio_redirty_for_writepage(wbc, folio);
+		folio_unlock(folio);
+		return 0;
+	}
+
+	folio_start_writeback(folio);
+	for (i = 0; i < folio_nr_pages(folio) && pos < isize; i++, pos += PAGE_SIZE) {
+		len = MIN(isize - pos, PAGE_SIZE);
+
+		kaddr = kmap_local_page(folio_page(folio, i));
+		ret = myfs_copy_to_blocks(inode, kaddr, pos, len);
+		kunmap_local(kaddr);
+		if (ret) {
+			mapping_set_error(folio->mapping, ret);
+			break;
+		}
+	}
+	up_read(&info->block_rwsem);
+	folio_unlock(folio);
+	folio_end_writeback(folio);
+
+	return ret;
+}
+
+/*
+ * Readahead may have left a large folio here, and uptodate is a property
+ * of the whole folio: unless the write covers all of it, fill all of it.
+ */
+static int myfs_write_begin(struct file *file, struct address_space *mapping,
+		loff_t pos, unsigned len, struct page **pagep, void **fsdata)
+{
+	pgoff_t index = pos >> PAGE_SHIFT;
+	struct folio *folio;
+	int ret;
+
+	folio = __filemap_get_folio(mapping, index, FGP_WRITEBEGIN,
+				    mapping_gfp_mask(mapping));
+	if (!folio)
+		return -ENOMEM;
+
+	if (!folio_test_uptodate(folio) && len != folio_size(folio)) {
+		ret = myfs_fill_folio(mapping->host, folio);
+		if (ret) {
+			folio_unlock(folio);
+			folio_put(folio);
+			return ret;
+		}
+	}
+
+	*pagep = folio_file_page(folio, index);
+	return 0;
+}
+
+/*
+ * Copied bytes are written through to the block store right away, so the
+ * page stays clean and the page cache can drop it under memory pressure.
+ */
+static int myfs_write_end(struct file *file, struct address_space *mapping,
+		loff_t pos, unsigned len, unsigned copied, struct page *page, void *fsdata)
+{
+	struct folio *folio = page_folio(page);
+	struct inode *inode = mapping->host;
+	char *kaddr;
+	int ret;
+
+	/* only a single page folio the write fully covers is left unfilled */
+	if (!folio_test_uptodate(folio)) {
+		if (copied < len) {
+			copied = 0;
+			goto out;
+		}
+		folio_mark_uptodate(folio);
+	}
+
+	kaddr = kmap_local_page(page);
+	ret = myfs_copy_to_blocks(inode, kaddr + offset_in_page(pos), pos, copied);
+	kunmap_local(kaddr);
+	if (ret) {
+		folio_unlock(folio);
+		folio_put(folio);
+		return ret;
+	}
+
+	if (pos + copied > inode->i_size)
+		i_size_write(inode, pos + copied);
+
+out:
+	folio_unlock(folio);
+	folio_put(folio);
+
+	return copied;
+}
+
+/*
+ * Copy between @iter and the file at @pos for direct I/O, a whole block at
+ * a time straight to or from the block store. Inline data and shared
+ * blocks cannot be accessed in place and go through a bounce buffer.
+ *
+ * Callers hold the invalidate lock shared, which keeps punch, truncate and
+ * the background passes from swapping blocks out under the copy.
+ */
+static ssize_t myfs_dio_copy(struct inode *inode, struct iov_iter *iter, loff_t pos)
+{
+	struct myfs_inode_info *info = MYFS_I(inode);
+	struct myfs_sb_info *sbi = MYFS_SB(inode->i_sb);
+	bool write = iov_iter_rw(iter) == WRITE;
+	size_t offset, chunk, copied;
+	unsigned long index;
+	char *bounce = NULL;
+	char *block;
+	ssize_t done = 0;
+	int err = 0;
+
+	while (iov_iter_count(iter)) {
+		index = pos >> sbi->blocksize_bits;
+		offset = pos & (sbi->blocksize - 1);
+		chunk = MIN(iov_iter_count(iter), sbi->blocksize - offset);
+
+		if (myfs_is_inline(inode)) {
+			block = NULL;
+		} else if (write) {
+			block = myfs_get_block(inode, index, MYFS_GB_CREATE | MYFS_GB_WRITE);
+		} else {
+			block = myfs_get_block(inode, index, 0);
+			if (!block) {
+				copied = iov_iter_zero(chunk, iter);
+				goto next;
+			}
+			if (!IS_ERR(block) && xa_get_mark(&info->blocks, index, MYFS_MARK_SHARED))
+				block = NULL;
+		}
+		if (IS_ERR(block)) {
+			err = PTR_ERR(block);
+			break;
+		}
+
+		if (block) {
+			if (write)
+				copied = copy_from_iter(block + offset, chunk, iter);
+			else
+				copied = copy_to_iter(block + offset, chunk, iter);
+			goto next;
+		}
+
+		if (!bounce) {
+			bounce = kvmalloc(sbi->blocksize, GFP_KERNEL);
+			if (!bounce) {
+				err = -ENOMEM;
+				break;
+			}
+		}
+		if (write) {
+			copied = copy_from_iter(bounce, chunk, iter);
+			err = myfs_copy_to_blocks(inode, bounce, pos, copied);
+		} else {
+			err = myfs_copy_from_blocks(inode, bounce, pos, chunk);
+			copied = err ? 0 : copy_to_iter(bounce, chunk, iter);
+		}
+		if (err)
+			break;
+
+next:
+		done += copied;
+		pos += copied;
+		if (copied < chunk) {
+			err = -EFAULT;
+			break;
+		}
+		cond_resched();
+	}
+
+	kvfree(bounce);
+
+	return done ?: err;
+}
+
+/*
+ * An aio or io_uring request is pinned into a bvec array and copied by a
+ * worker, so the submitter can go on queueing more while this one runs.
+ */
+struct myfs_dio {
+	struct work_struct work;
+	struct kiocb *iocb;
+	loff_t pos;
+	struct iov_iter iter;
+	struct bio_vec *bvec;
+	unsigned int nr_pages;
+};
+
+static void myfs_dio_unpin(struct myfs_dio *dio, bool dirty)
+{
+	unsigned int i;
+
+	for (i = 0; i < dio->nr_pages; i++) {
+		if (dirty)
+			set_page_dirty_lock(dio->bvec[i].bv_page);
+		put_page(dio->bvec[i].bv_page);
+	}
+	kvfree(dio->bvec);
+}
+
+static int myfs_dio_pin(struct myfs_dio *dio, struct iov_iter *iter)
+{
+	unsigned int max = iov_iter_npages(iter, INT_MAX);
+	size_t count = iov_iter_count(iter);
+	struct page **pages;
+	struct bio_vec *bv;
+	size_t start, len;
+	unsigned int i;
+	ssize_t got;
+	int err = 0;
+
+	dio->bvec = kvmalloc_array(max, sizeof(*dio->bvec), GFP_KERNEL);
+	pages = kvmalloc_array(max, sizeof(*pages), GFP_KERNEL);
+	if (!dio->bvec || !pages) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	while (iov_iter_count(iter) && dio->nr_pages < max) {
+		got = iov_iter_get_pages2(iter, pages, iov_iter_count(iter),
+					  max - dio->nr_pages, &start);
+		if (got <= 0) {
+			err = got ?: -EFAULT;
+			break;
+		}
+		for (i = 0; got > 0; i++, got -= len, start = 0) {
+			len = MIN(got, PAGE_SIZE - start);
+			bv = &dio->bvec[dio->nr_pages++];
+			bv->bv_page = pages[i];
+			bv->bv_len = len;
+			bv->bv_offset = start;
+		}
+	}
+
+out:
+	kvfree(pages);
+	if (err) {
+		myfs_dio_unpin(dio, false);
+		return err;
+	}
+	iov_iter_bvec(&dio->iter, iov_iter_rw(iter), dio->bvec, dio->nr_pages, count);
+
+	return 0;
+}
+
+static void myfs_dio_work(struct work_struct *work)
+{
+	struct myfs_dio *dio = container_of(work, struct myfs_dio, work);
+	struct kiocb *iocb = dio->iocb;
+	struct inode *inode = file_inode(iocb->ki_filp);
+	ssize_t ret;
+
+	filemap_invalidate_lock_shared(inode->i_mapping);
+	ret = myfs_dio_copy(inode, &dio->iter, dio->pos);
+	filemap_invalidate_unlock_shared(inode->i_mapping);
+
+	/*
+	 * The request was queued, so generic_file_direct_write() did not drop
+	 * the page cache after it: folios read in while the copy ran are stale.
+	 */
+	if (ret > 0 && iov_iter_rw(&dio->iter) == WRITE)
+		invalidate_inode_pages2_range(inode->i_mapping, dio->pos >> PAGE_SHIFT,
+					      (dio->pos + ret - 1) >> PAGE_SHIFT);
+
+	myfs_dio_unpin(dio, iov_iter_rw(&dio->iter) == READ);
+	if (ret > 0)
+		iocb->ki_pos = dio->pos + ret;
+	inode_dio_end(inode);
+
+	iocb->ki_complete(iocb, ret);
+	kfree(dio);
+}
+
+static ssize_t myfs_dio_queue(struct kiocb *iocb, struct iov_iter *iter)
+{
+	struct inode *inode = file_inode(iocb->ki_filp);
+	struct myfs_dio *dio;
+	int err;
+
+	dio = kzalloc(sizeof(*dio), GFP_KERNEL);
+	if (!dio)
+		return -ENOMEM;
+
+	err = myfs_dio_pin(dio, iter);
+	if (err) {
+		kfree(dio);
+		return err;
+	}
+
+	INIT_WORK(&dio->work, myfs_dio_work);
+	dio->iocb = iocb;
+	dio->pos = iocb->ki_pos;
+
+	/* truncate and hole punching wait for queued requests */
+	inode_dio_begin(inode);
+	queue_work(system_unbound_wq, &dio->work);
+
+	return -EIOCBQUEUED;
+}
+
+/*
+ * Reads are cut at EOF. Extending writes are always done synchronously,
+ * under the i_rwsem the write path holds, as are requests that are not
+ * async or whose buffers are not user memory.
+ */
+static ssize_t myfs_direct_IO(struct kiocb *iocb, struct iov_iter *iter)
+{
+	struct inode *inode = file_inode(iocb->ki_filp);
+	loff_t isize = i_size_read(inode);
+	loff_t pos = iocb->ki_pos;
+	size_t shorted = 0;
+	ssize_t ret;
+
+	if (iov_iter_rw(iter) == READ) {
+		if (pos >= isize)
+			return 0;
+		shorted = iov_iter_count(iter);
+		iov_iter_truncate(iter, isize - pos);
+		shorted -= iov_iter_count(iter);
+	}
+
+	if (!is_sync_kiocb(iocb) && user_backed_iter(iter) &&
+	    (iov_iter_rw(iter) == READ || pos + iov_iter_count(iter) <= isize)) {
+		ret = myfs_dio_queue(iocb, iter);
+	} else if ((iocb->ki_flags & IOCB_NOWAIT) &&
+		   !down_read_trylock(&inode->i_mapping->invalidate_lock)) {
+		ret = -EAGAIN;
+	} else {
+		if (!(iocb->ki_flags & IOCB_NOWAIT))
+			filemap_invalidate_lock_shared(inode->i_mapping);
+		ret = myfs_dio_copy(inode, iter, pos);
+		filemap_invalidate_unlock_shared(inode->i_mapping);
+	}
+
+	iov_iter_reexpand(iter, iov_iter_count(iter) + shorted);
+
+	return ret;
+}
+
+static ssize_t myfs_file_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct inode *inode = file_inode(iocb->ki_filp);
+	size_t count = iov_iter_count(to);
+	loff_t pos = iocb->ki_pos;
+	u64 start = ktime_get_ns();
+	ssize_t ret;
+
+	ret = generic_file_read_iter(iocb, to);
+
+	myfs_stat_io(MYFS_SB(inode->i_sb), MYFS_OP_READ, ret, ktime_get_ns() - start);
+	trace_myfs_read(inode, pos, count, ret);
+
+	return ret;
+}
+
+/*
+ * Range locks for writes that do not change the file size. Such writers
+ * hold i_rwsem shared, which keeps out everything that changes the size
+ * or swaps blocks, and lock the pages they write to among themselves, so
+ * writers to disjoint parts of a file run in parallel while overlapping
+ * writes stay atomic with respect to each other.
+ */
+struct myfs_range {
+	struct rb_node rb;
+	pgoff_t start;
+	pgoff_t last;
+	pgoff_t subtree_last;
+};
+
+#define MYFS_RANGE_START(range)	((range)->start)
+#define MYFS_RANGE_LAST(range)	((range)->last)
+
+INTERVAL_TREE_DEFINE(struct myfs_range, rb, pgoff_t, subtree_last,
+		     MYFS_RANGE_START, MYFS_RANGE_LAST, static, myfs_range_tree)
+
+static bool myfs_range_trylock(struct myfs_inode_info *info, struct myfs_range *range)
+{
+	bool locked = false;
+
+	spin_lock(&info->range_lock);
+	if (!myfs_range_tree_iter_first(&info->ranges, range->start, range->last)) {
+		myfs_range_tree_insert(range, &info->ranges);
+		locked = true;
+	}
+	spin_unlock(&info->range_lock);
+
+	return locked;
+}
+
+static void myfs_range_lock(struct inode *inode, struct myfs_range *range,
+		loff_t pos, size_t len)
+{
+	struct myfs_inode_info *info = MYFS_I(inode);
+
+	range->start = pos >> PAGE_SHIFT;
+	range->last = (pos + len - 1) >> PAGE_SHIFT;
+
+	wait_var_event(&info->ranges, myfs_range_trylock(info, range));
+}
+
+static void myfs_range_unlock(struct inode *inode, struct myfs_range *range)
+{
+	struct myfs_inode_info *info = MYFS_I(inode);
+
+	spin_lock(&info->range_lock);
+	myfs_range_tree_remove(range, &info->ranges);
+	spin_unlock(&info->range_lock);
+
+	/* pairs with the waitqueue check in wake_up_var() */
+	smp_mb();
+	wake_up_var(&info->ranges);
+}
+
+/*
+ * Appends and writes past EOF change the size, and a write to a file whose
+ * privileges have not been checked yet may have to clear setuid bits;
+ * both need i_rwsem exclusive.
+ */
+static bool myfs_write_in_place(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct inode *inode = file_inode(iocb->ki_filp);
+
+	return !(iocb->ki_flags & IOCB_APPEND) && IS_NOSEC(inode) &&
+		iocb->ki_pos + iov_iter_count(from) <= i_size_read(inode);
+}
+
+static ssize_t myfs_write_shared(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct inode *inode = file_inode(iocb->ki_filp);
+	struct myfs_range range;
+	ssize_t ret;
+
+	ret = generic_write_checks(iocb, from);
+	if (ret > 0) {
+		myfs_range_lock(inode, &range, iocb->ki_pos, ret);
+		ret = __generic_file_write_iter(iocb, from);
+		myfs_range_unlock(inode, &range);
+	}
+
+	return ret;
+}
+
+/*
+ * Open-coded generic_file_write_iter, so the time spent waiting for
+ * i_rwsem can be accounted. Writes that will fill many fresh blocks get
+ * them from the pool in one bulk refill before the page-by-page copy.
+ */
+static ssize_t myfs_file_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct inode *inode = file_inode(iocb->ki_filp);
+	struct myfs_sb_info *sbi = MYFS_SB(inode->i_sb);
+	size_t count = iov_iter_count(from);
+	u64 start, locked;
+	ssize_t ret;
+
+	start = ktime_get_ns();
+	if (myfs_write_in_place(iocb, from)) {
+		inode_lock_shared(inode);
+		/* the size may have changed while we waited */
+		if (myfs_write_in_place(iocb, from)) {
+			this_cpu_add(sbi->stats->lock_wait_ns, ktime_get_ns() - start);
+			ret = myfs_write_shared(iocb, from);
+			inode_unlock_shared(inode);
+			goto out;
+		}
+		inode_unlock_shared(inode);
+	}
+
+	inode_lock(inode);
+	locked = ktime_get_ns();
+	this_cpu_add(sbi->stats->lock_wait_ns, locked - start);
+
+	ret = generic_write_checks(iocb, from);
+	if (ret > 0) {
+		if (iocb->ki_pos + iov_iter_count(from) > i_size_read(inode))
+			myfs_pool_prefill(&sbi->pool,
+					  DIV_ROUND_UP(iov_iter_count(from), sbi->blocksize));
+		ret = __generic_file_write_iter(iocb, from);
+	}
+	inode_unlock(inode);
+
+out:
+	if (ret > 0)
+		ret = generic_write_sync(iocb, ret);
+
+	myfs_stat_io(sbi, MYFS_OP_WRITE, ret, ktime_get_ns() - start);
+	trace_myfs_write(inode, iocb->ki_pos - (ret > 0 ? ret : 0), count, ret);
+
+	return ret;
+}
+
+static int myfs_fsync(struct file *file, loff_t start, loff_t end, int datasync)
+{
+	return file_write_and_wait_range(file, start, end);
+}
+
+/* Directories of a memory-backed mount have nothing to write. */
+static int myfs_dir_fsync(struct file *file, loff_t start, loff_t end, int datasync)
+{
+	if (MYFS_SB(file_inode(file)->i_sb)->disk)
+		return myfs_disk_fsync_dir(file, datasync);
+	return 0;
+}
+
+/* Holes are the block indices missing from the xarray. */
+static loff_t myfs_seek_hole_data(struct inode *inode, loff_t offset, int whence)
+{
+	struct myfs_inode_info *info = MYFS_I(inode);
+	struct myfs_sb_info *sbi = MYFS_SB(inode->i_sb);
+	loff_t isize = i_size_read(inode);
+	unsigned long index, last;
+
+	if (offset < 0 || offset >= isize)
+		return -ENXIO;
+
+	/* Pages dirtied through mmap are data as well. */
+	filemap_write_and_wait(inode->i_mapping);
+
+	/* Inline files are data up to the inline size and a hole after it. */
+	if (myfs_is_inline(inode)) {
+		if (whence == SEEK_DATA)
+			return offset < myfs_inline_size ? offset : -ENXIO;
+		return MIN(MAX(offset, (loff_t)myfs_inline_size), isize);
+	}
+
+	index = offset >> sbi->blocksize_bits;
+	last = (isize - 1) >> sbi->blocksize_bits;
+
+	if (whence == SEEK_DATA) {
+		if (!xa_find(&info->blocks, &index, last, XA_PRESENT))
+			return -ENXIO;
+	} else {
+		while (index <= last && xa_load(&info->blocks, index))
+			index++;
+	}
+
+	offset = MAX(offset, (loff_t)index << sbi->blocksize_bits);
+
+	return MIN(offset, isize);
+}
+
+static loff_t myfs_file_llseek(struct file *file, loff_t offset, int whence)
+{
+	struct inode *inode = file_inode(file);
+
+	if (whence != SEEK_DATA && whence != SEEK_HOLE)
+		return generic_file_llseek(file, offset, whence);
+
+	inode_lock_shared(inode);
+	offset = myfs_seek_hole_data(inode, offset, whence);
+	if (offset >= 0)
+		offset = vfs_setpos(file, offset, inode->i_sb->s_maxbytes);
+	inode_unlock_shared(inode);
+
+	return offset;
+}
+
+/*
+ * Copy @len bytes of block data between two files of the same mount.
+ * Holes in the source stay holes in the destination.
+ */
+static ssize_t myfs_copy_blocks(struct inode *src, loff_t pos_in,
+		struct inode *dst, loff_t pos_out, size_t len)
+{
+	struct myfs_sb_info *sbi = MYFS_SB(src->i_sb);
+	size_t in_off, out_off, chunk, done = 0;
+	unsigned int flags;
+	char *to;
+	int ret;
+
+	while (done < len) {
+		in_off = pos_in & (sbi->blocksize - 1);
+		out_off = pos_out & (sbi->blocksize - 1);
+		chunk = MIN(len - done, sbi->blocksize - MAX(in_off, out_off));
+
+		flags = MYFS_GB_WRITE;
+		if (xa_load(&MYFS_I(src)->blocks, pos_in >> sbi->blocksize_bits))
+			flags |= MYFS_GB_CREATE;
+		to = myfs_get_block(dst, pos_out >> sbi->blocksize_bits, flags);
+		if (IS_ERR(to))
+			return done ? done : PTR_ERR(to);
+
+		if (to) {
+			ret = myfs_read_block(src, pos_in >> sbi->blocksize_bits,
+					      to + out_off, in_off, chunk);
+			if (ret)
+				return done ? done : ret;
+		}
+
+		pos_in += chunk;
+		pos_out += chunk;
+		done += chunk;
+	}
+
+	return done;
+}
+
+/*
+ * Both files are flushed so their blocks are current, the destination
+ * range is dropped from the page cache, and the data is then copied block
+ * to block without passing through the page cache or userspace.
+ */
+static ssize_t myfs_copy_file_range(struct file *file_in, loff_t pos_in,
+		struct file *file_out, loff_t pos_out, size_t len, unsigned int flags)
+{
+	struct inode *src = file_inode(file_in);
+	struct inode *dst = file_inode(file_out);
+	ssize_t ret;
+
+	/* A file small enough to be inline is cheaper to copy through the page cache. */
+	if (src->i_sb != dst->i_sb || myfs_is_inline(src))
+		return generic_copy_file_range(file_in, pos_in, file_out, pos_out, len, flags);
+
+	if (!len)
+		return 0;
+
+	lock_two_nondirectories(src, dst);
+
+	/* before the invalidate lock, which page faults take to read pages in */
+	ret = filemap_write_and_wait_range(src->i_mapping, pos_in, pos_in + len - 1);
+	if (!ret)
+		ret = filemap_write_and_wait_range(dst->i_mapping, pos_out, pos_out + len - 1);
+	if (ret) {
+		unlock_two_nondirectories(src, dst);
+		return ret;
+	}
+
+	filemap_invalidate_lock(dst->i_mapping);
+
+	ret = file_modified(file_out);
+	if (ret)
+		goto out;
+
+	ret = invalidate_inode_pages2_range(dst->i_mapping, pos_out >> PAGE_SHIFT,
+					    (pos_out + len - 1) >> PAGE_SHIFT);
+	if (ret)
+		goto out;
+
+	ret = myfs_convert_inline(dst);
+	if (ret)
+		goto out;
+
+	ret = myfs_copy_blocks(src, pos_in, dst, pos_out, len);
+	if (ret > 0 && pos_out + ret > i_size_read(dst))
+		i_size_write(dst, pos_out + ret);
+
+	file_accessed(file_in);
+
+out:
+	filemap_invalidate_unlock(dst->i_mapping);
+	unlock_two_nondirectories(src, dst);
+
+	return ret;
+}
+
+/*
+ * Point @nr blocks of @dst starting at @out at the blocks of @src starting
+ * at @in, dropping what @dst had there. Both inodes are locked against
+ * readers and writers.
+ */
+static int myfs_remap_blocks(struct inode *src, unsigned long in,
+		struct inode *dst, unsigned long out, unsigned long nr)
+{
+	struct myfs_inode_info *src_info = MYFS_I(src);
+	struct myfs_inode_info *dst_info = MYFS_I(dst);
+	struct myfs_sb_info *sbi = MYFS_SB(src->i_sb);
+	char *block, *old;
+	bool shared;
+	int err;
+
+	for (; nr; nr--, in++, out++) {
+		block = myfs_get_block(src, in, 0);
+		if (IS_ERR(block))
+			return PTR_ERR(block);
+
+		old = xa_load(&dst_info->blocks, out);
+		if (old && old == block)
+			continue;
+		if (old) {
+			shared = xa_get_mark(&dst_info->blocks, out, MYFS_MARK_SHARED);
+			xa_erase(&dst_info->blocks, out);
+			myfs_free_entry(sbi, old, shared);
+			atomic_long_dec(&dst_info->nr_blocks);
+			inode_sub_bytes(dst, sbi->blocksize);
+		}
+		if (!block)
+			continue;
+
+		shared = xa_get_mark(&src_info->blocks, in, MYFS_MARK_SHARED);
+		err = myfs_block_get(sbi, block, shared);
+		if (err)
+			return err;
+		xa_set_mark(&src_info->blocks, in, MYFS_MARK_SHARED);
+
+		err = xa_err(xa_store(&dst_info->blocks, out, block, GFP_NOFS));
+		if (err) {
+			myfs_block_put(sbi, block);
+			return err;
+		}
+		xa_set_mark(&dst_info->blocks, out, MYFS_MARK_SHARED);
+		atomic_long_inc(&dst_info->nr_blocks);
+		inode_add_bytes(dst, sbi->blocksize);
+		atomic_long_inc(&sbi->share_stats.cloned);
+
+		cond_resched();
+	}
+
+	return 0;
+}
+
+/*
+ * FICLONE, FICLONERANGE and FIDEDUPERANGE. The VFS checks have made the
+ * range block aligned, except that it may end at the source's EOF. Such a
+ * partial last block is shared too when it also becomes the destination's
+ * last block, and copied otherwise.
+ */
+static loff_t myfs_remap_file_range(struct file *file_in, loff_t pos_in,
+		struct file *file_out, loff_t pos_out, loff_t len, unsigned int remap_flags)
+{
+	struct inode *src = file_inode(file_in);
+	struct inode *dst = file_inode(file_out);
+	struct myfs_sb_info *sbi = MYFS_SB(src->i_sb);
+	loff_t ret, shared_len;
+
+	if (remap_flags & ~(REMAP_FILE_DEDUP | REMAP_FILE_ADVISORY))
+		return -EINVAL;
+
+	lock_two_nondirectories(src, dst);
+
+	/* the prep flushes again under the invalidate lock, finding little left */
+	ret = filemap_write_and_wait_range(src->i_mapping, pos_in,
+					   len ? pos_in + len - 1 : LLONG_MAX);
+	if (!ret)
+		ret = filemap_write_and_wait_range(dst->i_mapping, pos_out,
+						   len ? pos_out + len - 1 : LLONG_MAX);
+	if (ret) {
+		unlock_two_nondirectories(src, dst);
+		return ret;
+	}
+
+	filemap_invalidate_lock_two(src->i_mapping, dst->i_mapping);
+
+	ret = generic_remap_file_range_prep(file_in, pos_in, file_out, pos_out,
+					    &len, remap_flags);
+	if (ret < 0 || len == 0)
+		goto out;
+
+	truncate_inode_pages_range(dst->i_mapping, pos_out, pos_out + len - 1);
+
+	ret = myfs_convert_inline(src);
+	if (!ret)
+		ret = myfs_convert_inline(dst);
+	if (ret)
+		goto out;
+
+	if (pos_out + len >= i_size_read(dst))
+		shared_len = round_up(len, sbi->blocksize);
+	else
+		shared_len = round_down(len, sbi->blocksize);
+
+	/* keeps writepage of the source from writing into blocks being shared */
+	down_write(&MYFS_I(src)->block_rwsem);
+	if (dst != src)
+		down_write_nested(&MYFS_I(dst)->block_rwsem, SINGLE_DEPTH_NESTING);
+
+	ret = myfs_remap_blocks(src, pos_in >> sbi->blocksize_bits,
+				dst, pos_out >> sbi->blocksize_bits,
+				shared_len >> sbi->blocksize_bits);
+	if (!ret && shared_len < len) {
+		ret = myfs_copy_blocks(src, pos_in + shared_len, dst, pos_out + shared_len,
+				       len - shared_len);
+		ret = ret < 0 ? ret : 0;
+	}
+
+	if (dst != src)
+		up_write(&MYFS_I(dst)->block_rwsem);
+	up_write(&MYFS_I(src)->block_rwsem);
+	if (ret)
+		goto out;
+
+	if (pos_out + len > i_size_read(dst))
+		i_size_write(dst, pos_out + len);
+	ret = len;
+
+out:
+	filemap_invalidate_unlock_two(src->i_mapping, dst->i_mapping);
+	unlock_two_nondirectories(src, dst);
+
+	return ret;
+}
+
+/*
+ * Plain and FALLOC_FL_KEEP_SIZE calls allocate zeroed blocks for the range;
+ * FALLOC_FL_PUNCH_HOLE gives the blocks inside the range back to the pool.
+ */
+static long myfs_fallocate(struct file *file, int mode, loff_t offset, loff_t len)
+{
+	struct inode *inode = file_inode(file);
+	struct myfs_inode_info *info = MYFS_I(inode);
+	struct myfs_sb_info *sbi = MYFS_SB(inode->i_sb);
+	loff_t end = offset + len;
+	unsigned long index, first, last;
+	char *block;
+	bool hole;
+	long ret;
+
+	if (mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE))
+		return -EOPNOTSUPP;
+
+	inode_lock(inode);
+
+	ret = file_modified(file);
+	if (ret)
+		goto out;
+
+	inode_dio_wait(inode);
+
+	if (mode & FALLOC_FL_PUNCH_HOLE) {
+		trace_myfs_punch_hole(inode, offset, len);
+
+		filemap_invalidate_lock(inode->i_mapping);
+		truncate_pagecache_range(inode, offset, end - 1);
+		ret = myfs_punch_blocks(inode, offset, end);
+		filemap_invalidate_unlock(inode->i_mapping);
+		goto out;
+	}
+
+	trace_myfs_fallocate(inode, offset, len);
+
+	if (!(mode & FALLOC_FL_KEEP_SIZE)) {
+		ret = inode_newsize_ok(inode, end);
+		if (ret)
+			goto out;
+	}
+
+	ret = myfs_convert_inline(inode);
+	if (ret)
+		goto out;
+
+	first = offset >> sbi->blocksize_bits;
+	last = (end - 1) >> sbi->blocksize_bits;
+	myfs_pool_prefill(&sbi->pool, min_t(unsigned long, last - first + 1, MYFS_MAGAZINE_SIZE));
+
+	/*
+	 * Blocks allocated here are marked, and given back like tmpfs does if
+	 * the call fails part way. block_rwsem keeps writepage from filling a
+	 * hole between the lookup and the allocation.
+	 */
+	down_write(&info->block_rwsem);
+	for (index = first; index <= last; index++) {
+		if (fatal_signal_pending(current)) {
+			ret = -EINTR;
+			break;
+		}
+		hole = !xa_load(&info->blocks, index);
+		block = myfs_get_block(inode, index, MYFS_GB_CREATE);
+		if (IS_ERR(block)) {
+			ret = PTR_ERR(block);
+			break;
+		}
+		if (hole)
+			xa_set_mark(&info->blocks, index, MYFS_MARK_FALLOC);
+	}
+
+	xa_for_each_marked(&info->blocks, index, block, MYFS_MARK_FALLOC) {
+		if (index > last)
+			break;
+		if (!ret) {
+			xa_clear_mark(&info->blocks, index, MYFS_MARK_FALLOC);
+			continue;
+		}
+		xa_erase(&info->blocks, index);
+		myfs_free_entry(sbi, block, false);
+		atomic_long_dec(&info->nr_blocks);
+		inode_sub_bytes(inode, sbi->blocksize);
+	}
+	up_write(&info->block_rwsem);
+	if (ret)
+		goto out;
+
+	if (!(mode & FALLOC_FL_KEEP_SIZE) && end > i_size_read(inode))
+		i_size_write(inode, end);
+	inode->i_ctime = current_time(inode);
+
+out:
+	inode_unlock(inode);
+	return ret;
+}
+
+static long myfs_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	switch (cmd) {
+	case MYFS_IOC_DUMP:
+		if (!capable(CAP_SYS_ADMIN))
+			return -EPERM;
+		return myfs_image_dump(file_inode(file)->i_sb);
+	default:
+		return -ENOTTY;
+	}
+}
+
+int setattr(struct dentry *dentry, struct iattr *iattr) {
+	return 0;
+}
+
+
+struct inode *myfs_get_inode(struct super_block *sb, const struct inode *dir,
+		int mode)
+{
+	struct myfs_sb_info *sbi = MYFS_SB(sb);
+	struct inode *inode;
+
+	if (sbi->max_inodes &&
+	    percpu_counter_compare(&sbi->used_inodes, sbi->max_inodes) >= 0)
+		return NULL;
+
+	inode = new_inode(sb);
+	if (!inode)
+		return NULL;
+	percpu_counter_inc(&sbi->used_inodes);
+
+	/* TODO 3/3: fill inode structure
+	 *     - mode
+	 *     - uid
+	 *     - gid
+	 *     - atime,ctime,mtime
+	 *     - ino
+	 */
+	inode_init_owner(sb->s_user_ns, inode, dir, mode);
+	inode->i_atime = inode->i_mtime = inode->i_ctime = current_time(inode);
+	inode->i_ino = 1;
+
+	/* TODO 5/1: Init i_ino using get_next_ino */
+	inode->i_ino = get_next_ino();
+
+	/* TODO 6/1: Initialize address space operations. */
+	if (!sbi->disk) {
+		inode->i_mapping->a_ops = &myfs_aops;
+		mapping_set_large_folios(inode->i_mapping);
+	}
+
+	if (S_ISDIR(mode)) {
+		/* TODO 3/2: set inode operations for dir inodes. */
+		inode->i_op = &simple_dir_inode_operations;
+		inode->i_fop = &simple_dir_operations;
+
+		/* TODO 5/1: use myfs_dir_inode_operations for inode
+		 * operations (i_op).
+		 */
+		inode->i_op = &myfs_dir_inode_operations;
+		inode->i_fop = &myfs_dir_operations;
+
+		/* TODO 3/1: directory inodes start off with i_nlink == 2 (for "." entry).
+		 * Directory link count should be incremented (use inc_nlink).
+		 */
+		inc_nlink(inode);
+	}
+
+	if (sbi->disk) {
+		if (myfs_disk_new_inode(inode)) {
+			iput(inode);
+			return NULL;
+		}
+		return inode;
+	}
+
+	/* TODO 6/4: Set file inode and file operations for regular files
+	 * (use the S_ISREG macro).
+	 */
+	if (S_ISREG(mode)) {
+		inode->i_op = &myfs_file_inode_operations;
+		inode->i_fop = &myfs_file_operations;
+
+		spin_lock(&MYFS_SB(sb)->inodes_lock);
+		list_add(&MYFS_I(inode)->sb_list, &MYFS_SB(sb)->inodes);
+		spin_unlock(&MYFS_SB(sb)->inodes_lock);
+
+		if (myfs_inline_size) {
+			memset(MYFS_I(inode)->inline_data, 0, myfs_inline_size);
+			set_bit(MYFS_I_INLINE, &MYFS_I(inode)->flags);
+		}
+	}
+
+	return inode;
+}
+
+/* TODO 5/33: Implement myfs_mknod, myfs_create, myfs_mkdir. */
+static int myfs_mknod(struct user_namespace *user_ns, struct inode *dir,
+		struct dentry *dentry, umode_t mode, dev_t dev)
+{
+	struct inode *inode = myfs_get_inode(dir->i_sb, dir, mode);
+	int err;
+
+	if (inode == NULL)
+		return -ENOSPC;
+
+	err = myfs_dir_add(dir, dentry);
+	if (err) {
+		/* it never had a name, so nothing stays behind on disk */
+		clear_nlink(inode);
+		iput(inode);
+		return err;
+	}
+
+	d_instantiate(dentry, inode);
+	dget(dentry);
+	dir->i_mtime = dir->i_ctime = current_time(inode);
+
+	return 0;
+}
+
+int myfs_setattr(struct user_namespace *user_ns, struct dentry *dentry, struct iattr *attr) {
+	struct inode *inode = d_inode(dentry);
+	loff_t oldsize;
+	int error;
+
+	error = setattr_prepare(user_ns, dentry, attr);
+	if (error)
+		return error;
+
+	if ((attr->ia_valid & ATTR_SIZE) &&
+		attr->ia_size != i_size_read(inode)) {
+		error = inode_newsize_ok(inode, attr->ia_size);
+		if (error)
+			return error;
+
+		inode_dio_wait(inode);
+		filemap_invalidate_lock(inode->i_mapping);
+		oldsize = i_size_read(inode);
+		trace_myfs_setsize(inode, oldsize, attr->ia_size);
+		truncate_setsize(inode, attr->ia_size);
+		/* Blocks preallocated past EOF go too. */
+		if (attr->ia_size < oldsize)
+			error = myfs_punch_blocks(inode, attr->ia_size, MAX_LFS_FILESIZE);
+		filemap_invalidate_unlock(inode->i_mapping);
+		if (error)
+			return error;
+	}
+
+	setattr_copy(user_ns, inode, attr);
+	mark_inode_dirty(inode);
+
+	return 0;
+}
+
+static int myfs_create(struct user_namespace *user_ns, struct inode *dir, struct dentry *dentry,
+		umode_t mode, bool excl)
+{
+	return myfs_mknod(user_ns, dir, dentry, mode | S_IFREG, 0);
+}
+
+static int myfs_mkdir(struct user_namespace *user_ns, struct inode *dir, struct dentry *dentry, umode_t mode)
+{
+	int ret;
+
+	ret = myfs_mknod(user_ns, dir, dentry, mode | S_IFDIR, 0);
+	if (ret != 0)
+		return ret;
+
+	inc_nlink(dir);
+
+	return 0;
+}
+
+/*
+ * Directory index.
+ *
+ * Every directory keeps its entries in an xarray indexed by a cookie that
+ * is allocated cyclically when the entry is created and stays with it
+ * until it is unlinked or renamed. readdir walks the xarray from the
+ * cookie in f_pos, so it resumes where it stopped in O(1) per entry however
+ * big the directory is, and lseek to a cookie telldir returned is free.
+ * 0 and 1 are taken by "." and "..". The cookie of an entry is kept in
+ * its dentry's d_fsdata.
+ *
+ * Name lookup stays with the dcache, whose hash table already finds any
+ * entry of a myfs directory, as they are all pinned there.
+ */
+#define MYFS_DIR_LIMIT		XA_LIMIT(2, U32_MAX)
+
+static unsigned long myfs_dir_cookie(struct dentry *dentry)
+{
+	return (unsigned long)dentry->d_fsdata;
+}
+
+int myfs_dir_add(struct inode *dir, struct dentry *dentry)
+{
+	struct myfs_inode_info *info = MYFS_I(dir);
+	u32 cookie;
+	int err;
+
+	err = xa_alloc_cyclic(&info->dir_index, &cookie, dentry, MYFS_DIR_LIMIT,
+			      &info->dir_next, GFP_KERNEL);
+	if (err < 0)
+		return err;
+
+	dentry->d_fsdata = (void *)(unsigned long)cookie;
+
+	return 0;
+}
+
+static void myfs_dir_remove(struct inode *dir, struct dentry *dentry)
+{
+	xa_erase(&MYFS_I(dir)->dir_index, myfs_dir_cookie(dentry));
+}
+
+static bool myfs_dir_empty(struct inode *dir)
+{
+	return xa_empty(&MYFS_I(dir)->dir_index);
+}
+
+/* i_rwsem held shared keeps the entries and their names stable. */
+static int myfs_readdir(struct file *file, struct dir_context *ctx)
+{
+	struct xarray *index = &MYFS_I(file_inode(file))->dir_index;
+	struct dentry *dentry;
+	struct inode *inode;
+	unsigned long cookie;
+
+	if (!dir_emit_dots(file, ctx))
+		return 0;
+
+	xa_for_each_start(index, cookie, dentry, ctx->pos) {
+		inode = d_inode(dentry);
+		if (!dir_emit(ctx, dentry->d_name.name, dentry->d_name.len, inode->i_ino,
+			      fs_umode_to_dtype(inode->i_mode)))
+			break;
+		ctx->pos = cookie + 1;
+		cond_resched();
+	}
+
+	return 0;
+}
+
+static loff_t myfs_dir_llseek(struct file *file, loff_t offset, int whence)
+{
+	return generic_file_llseek_size(file, offset, whence, U32_MAX, U32_MAX);
+}
+
+static int myfs_link(struct dentry *old_dentry, struct inode *dir, struct dentry *dentry)
+{
+	int err;
+
+	err = myfs_dir_add(dir, dentry);
+	if (err)
+		return err;
+
+	return simple_link(old_dentry, dir, dentry);
+}
+
+static int myfs_unlink(struct inode *dir, struct dentry *dentry)
+{
+	myfs_dir_remove(dir, dentry);
+
+	return simple_unlink(dir, dentry);
+}
+
+/* simple_rmdir() without its walk over the children. */
+static int myfs_rmdir(struct inode *dir, struct dentry *dentry)
+{
+	if (!myfs_dir_empty(d_inode(dentry)))
+		return -ENOTEMPTY;
+
+	myfs_dir_remove(dir, dentry);
+	drop_nlink(d_inode(dentry));
+	simple_unlink(dir, dentry);
+	drop_nlink(dir);
+
+	return 0;
+}
+
+/*
+ * The renamed entry gets a new cookie in its new directory, which is
+ * allocated first, as that is the only step that can fail. An exchange
+ * swaps the two cookies.
+ */
+static int myfs_rename(struct user_namespace *user_ns, struct inode *old_dir,
+		struct dentry *old_dentry, struct inode *new_dir, struct dentry *new_dentry,
+		unsigned int flags)
+{
+	unsigned long old_cookie = myfs_dir_cookie(old_dentry);
+	struct inode *inode = d_inode(old_dentry);
+	u32 cookie;
+	int err;
+
+	if (flags & ~(RENAME_NOREPLACE | RENAME_EXCHANGE))
+		return -EINVAL;
+
+	if (flags & RENAME_EXCHANGE) {
+		xa_store(&MYFS_I(old_dir)->dir_index, old_cookie, new_dentry, GFP_KERNEL);
+		xa_store(&MYFS_I(new_dir)->dir_index, myfs_dir_cookie(new_dentry), old_dentry,
+			 GFP_KERNEL);
+		swap(old_dentry->d_fsdata, new_dentry->d_fsdata);
+		return simple_rename_exchange(old_dir, old_dentry, new_dir, new_dentry);
+	}
+
+	if (d_is_dir(new_dentry) && !myfs_dir_empty(d_inode(new_dentry)))
+		return -ENOTEMPTY;
+
+	err = xa_alloc_cyclic(&MYFS_I(new_dir)->dir_index, &cookie, old_dentry,
+			      MYFS_DIR_LIMIT, &MYFS_I(new_dir)->dir_next, GFP_KERNEL);
+	if (err < 0)
+		return err;
+
+	if (d_really_is_positive(new_dentry)) {
+		myfs_dir_remove(new_dir, new_dentry);
+		simple_unlink(new_dir, new_dentry);
+		if (d_is_dir(old_dentry)) {
+			drop_nlink(d_inode(new_dentry));
+			drop_nlink(old_dir);
+		}
+	} else if (d_is_dir(old_dentry)) {
+		drop_nlink(old_dir);
+		inc_nlink(new_dir);
+	}
+
+	xa_erase(&MYFS_I(old_dir)->dir_index, old_cookie);
+	old_dentry->d_fsdata = (void *)(unsigned long)cookie;
+
+	old_dir->i_ctime = old_dir->i_mtime = new_dir->i_ctime = new_dir->i_mtime =
+		inode->i_ctime = current_time(old_dir);
+
+	return 0;
+}
+
+enum {
+	Opt_blocksize,
+	Opt_size,
+	Opt_nr_inodes,
+	Opt_compress,
+	Opt_compress_age,
+	Opt_dedup,
+	Opt_image,
+	Opt_swap,
+	Opt_err,
+};
+
+static const match_table_t myfs_tokens = {
+	{Opt_blocksize, "blocksize=%s"},
+	{Opt_size, "size=%s"},
+	{Opt_nr_inodes, "nr_inodes=%s"},
+	{Opt_compress, "compress=%s"},
+	{Opt_compress_age, "compress_age=%u"},
+	{Opt_dedup, "dedup=%u"},
+	{Opt_image, "image=%s"},
+	{Opt_swap, "swap=%s"},
+	{Opt_err, NULL},
+};
+
+static int myfs_parse_options(char *data, struct myfs_sb_info *sbi)
+{
+	substring_t args[MAX_OPT_ARGS];
+	unsigned long long size;
+	char *p, *rest;
+	int age;
+
+	if (!data)
+		return 0;
+
+	while ((p = strsep(&data, ",")) != NULL) {
+		if (!*p)
+			continue;
+
+		switch (match_token(p, myfs_tokens, args)) {
+		case Opt_blocksize:
+			size = memparse(args[0].from, &rest);
+			if (*rest || size < MYFS_MIN_BLOCKSIZE ||
+			    size > MYFS_MAX_BLOCKSIZE || !is_power_of_2(size)) {
+				pr_err("myfs: invalid blocksize '%s', expected a power of two from 4K to 2M\n",
+				       args[0].from);
+				return -EINVAL;
+			}
+			sbi->blocksize = size;
+			sbi->blocksize_bits = ilog2(size);
+			break;
+		case Opt_size:
+			/* as in tmpfs, a trailing '%' is a share of physical RAM */
+			size = memparse(args[0].from, &rest);
+			if (*rest == '%') {
+				size <<= PAGE_SHIFT;
+				size *= totalram_pages();
+				do_div(size, 100);
+				rest++;
+			}
+			if (*rest) {
+				pr_err("myfs: invalid size '%s'\n", args[0].from);
+				return -EINVAL;
+			}
+			sbi->max_bytes = size;
+			break;
+		case Opt_nr_inodes:
+			size = memparse(args[0].from, &rest);
+			if (*rest || size > ULONG_MAX) {
+				pr_err("myfs: invalid nr_inodes '%s'\n", args[0].from);
+				return -EINVAL;
+			}
+			sbi->max_inodes = size;
+			break;
+		case Opt_compress:
+			kfree(sbi->comp_alg);
+			sbi->comp_alg = match_strdup(&args[0]);
+			if (!sbi->comp_alg)
+				return -ENOMEM;
+			break;
+		case Opt_compress_age:
+			if (match_int(&args[0], &age) || age <= 0) {
+				pr_err("myfs: invalid compress_age '%s'\n", args[0].from);
+				return -EINVAL;
+			}
+			sbi->comp_age = age;
+			break;
+		case Opt_dedup:
+			if (match_int(&args[0], &age) || age < 0) {
+				pr_err("myfs: invalid dedup interval '%s'\n", args[0].from);
+				return -EINVAL;
+			}
+			sbi->dedup_interval = age;
+			break;
+		case Opt_image:
+			kfree(sbi->image);
+			sbi->image = match_strdup(&args[0]);
+			if (!sbi->image)
+				return -ENOMEM;
+			break;
+		case Opt_swap:
+			kfree(sbi->swap_path);
+			sbi->swap_path = match_strdup(&args[0]);
+			if (!sbi->swap_path)
+				return -ENOMEM;
+			break;
+		default:
+			pr_err("myfs: unrecognized mount option '%s'\n", p);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static int myfs_show_options(struct seq_file *m, struct dentry *root)
+{
+	struct myfs_sb_info *sbi = MYFS_SB(root->d_sb);
+
+	if (sbi->blocksize != MYFS_DEFAULT_BLOCKSIZE)
+		seq_printf(m, ",blocksize=%u", sbi->blocksize);
+	if (sbi->max_bytes)
+		seq_printf(m, ",size=%lluk", sbi->max_bytes >> 10);
+	if (sbi->max_inodes)
+		seq_printf(m, ",nr_inodes=%lu", sbi->max_inodes);
+	if (sbi->comp_alg)
+		seq_printf(m, ",compress=%s", sbi->comp_alg);
+	if (sbi->comp_age != MYFS_DEFAULT_COMPRESS_AGE)
+		seq_printf(m, ",compress_age=%u", sbi->comp_age);
+	if (sbi->dedup_interval)
+		seq_printf(m, ",dedup=%u", sbi->dedup_interval);
+	if (sbi->image)
+		seq_show_option(m, "image", sbi->image);
+	if (sbi->swap_path)
+		seq_show_option(m, "swap", sbi->swap_path);
+
+	return 0;
+}
+
+/*
+ * Without a size= limit the capacity reported is what is in use plus the
+ * memory that is still available.
+ */
+static int myfs_statfs(struct dentry *dentry, struct kstatfs *buf)
+{
+	struct myfs_sb_info *sbi = MYFS_SB(dentry->d_sb);
+	unsigned long used = percpu_counter_sum_positive(&sbi->used_blocks);
+	unsigned long avail;
+
+	buf->f_type = MYFS_MAGIC;
+	buf->f_bsize = sbi->blocksize;
+	buf->f_namelen = NAME_MAX;
+
+	if (sbi->max_blocks) {
+		buf->f_blocks = sbi->max_blocks;
+		avail = sbi->max_blocks > used ? sbi->max_blocks - used : 0;
+	} else {
+		avail = si_mem_available() >> (sbi->blocksize_bits - PAGE_SHIFT);
+		buf->f_blocks = used + avail;
+	}
+	buf->f_bfree = buf->f_bavail = avail;
+
+	if (sbi->max_inodes) {
+		buf->f_files = sbi->max_inodes;
+		buf->f_ffree = sbi->max_inodes -
+			min_t(s64, percpu_counter_sum_positive(&sbi->used_inodes),
+			      sbi->max_inodes);
+	}
+
+	return 0;
+}
+
+static int myfs_pool_stats_show(struct seq_file *m, void *v)
+{
+	struct myfs_sb_info *sbi = m->private;
+
+	myfs_pool_show(m, &sbi->pool);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(myfs_pool_stats);
+
+static void myfs_show_latency(struct seq_file *m, const char *name, u64 *buckets)
+{
+	int i;
+
+	seq_printf(m, "%s latency (ns):\n", name);
+	for (i = 0; i < MYFS_LAT_BUCKETS; i++) {
+		if (!buckets[i])
+			continue;
+		if (i == MYFS_LAT_BUCKETS - 1)
+			seq_printf(m, "  [%llu, inf): %llu\n", 1ULL << i, buckets[i]);
+		else
+			seq_printf(m, "  [%llu, %llu): %llu\n", i ? 1ULL << i : 0,
+				   1ULL << (i + 1), buckets[i]);
+	}
+}
+
+static int myfs_io_stats_show(struct seq_file *m, void *v)
+{
+	struct myfs_sb_info *sbi = m->private;
+	struct myfs_io_stats *sum, *stats;
+	int cpu, op, i;
+
+	sum = kzalloc(sizeof(*sum), GFP_KERNEL);
+	if (!sum)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		stats = per_cpu_ptr(sbi->stats, cpu);
+		for (op = 0; op < MYFS_NR_OPS; op++) {
+			sum->ops[op] += stats->ops[op];
+			sum->bytes[op] += stats->bytes[op];
+			for (i = 0; i < MYFS_LAT_BUCKETS; i++)
+				sum->latency[op][i] += stats->latency[op][i];
+		}
+		sum->blocks_allocated += stats->blocks_allocated;
+		sum->blocks_freed += stats->blocks_freed;
+		sum->lock_wait_ns += stats->lock_wait_ns;
+	}
+
+	seq_printf(m, "read_ops:         %llu\n", sum->ops[MYFS_OP_READ]);
+	seq_printf(m, "read_bytes:       %llu\n", sum->bytes[MYFS_OP_READ]);
+	seq_printf(m, "write_ops:        %llu\n", sum->ops[MYFS_OP_WRITE]);
+	seq_printf(m, "write_bytes:      %llu\n", sum->bytes[MYFS_OP_WRITE]);
+	seq_printf(m, "blocks_allocated: %llu\n", sum->blocks_allocated);
+	seq_printf(m, "blocks_freed:     %llu\n", sum->blocks_freed);
+	seq_printf(m, "lock_wait_ns:     %llu\n", sum->lock_wait_ns);
+	myfs_show_latency(m, "read", sum->latency[MYFS_OP_READ]);
+	myfs_show_latency(m, "write", sum->latency[MYFS_OP_WRITE]);
+
+	kfree(sum);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(myfs_io_stats);
+
+static int myfs_comp_stats_show(struct seq_file *m, void *v)
+{
+	myfs_compress_show(m, m->private);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(myfs_comp_stats);
+
+static int myfs_share_stats_show(struct seq_file *m, void *v)
+{
+	myfs_share_show(m, m->private);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(myfs_share_stats);
+
+static int myfs_swap_stats_show(struct seq_file *m, void *v)
+{
+	myfs_swap_show(m, m->private);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(myfs_swap_stats);
+
+/* Per-mount statistics live under <debugfs>/myfs/<major>:<minor>/. */
+static void myfs_debugfs_register(struct super_block *sb)
+{
+	struct myfs_sb_info *sbi = MYFS_SB(sb);
+	char name[32];
+
+	snprintf(name, sizeof(name), "%u:%u", MAJOR(sb->s_dev), MINOR(sb->s_dev));
+	sbi->debugfs_dir = debugfs_create_dir(name, myfs_debugfs_root);
+	debugfs_create_file("blockpool", 0444, sbi->debugfs_dir, sbi, &myfs_pool_stats_fops);
+	debugfs_create_file("iostats", 0444, sbi->debugfs_dir, sbi, &myfs_io_stats_fops);
+	debugfs_create_file("compression", 0444, sbi->debugfs_dir, sbi, &myfs_comp_stats_fops);
+	debugfs_create_file("sharing", 0444, sbi->debugfs_dir, sbi, &myfs_share_stats_fops);
+	debugfs_create_file("swap", 0444, sbi->debugfs_dir, sbi, &myfs_swap_stats_fops);
+}
+
+static int myfs_fill_super(struct super_block *sb, void *data, int silent)
+{
+	struct myfs_sb_info *sbi;
+	struct inode *root_inode;
+	struct dentry *root_dentry;
+	char *name;
+	int err;
+
+	sbi = kzalloc(sizeof(struct myfs_sb_info), GFP_KERNEL);
+	if (!sbi)
+		return -ENOMEM;
+	sb->s_fs_info = sbi;
+
+	sbi->blocksize = MYFS_DEFAULT_BLOCKSIZE;
+	sbi->blocksize_bits = ilog2(MYFS_DEFAULT_BLOCKSIZE);
+	sbi->comp_age = MYFS_DEFAULT_COMPRESS_AGE;
+	spin_lock_init(&sbi->inodes_lock);
+	INIT_LIST_HEAD(&sbi->inodes);
+	mutex_init(&sbi->image_lock);
+
+	err = myfs_parse_options(data, sbi);
+	if (err)
+		return err;
+
+	if (sbi->max_bytes)
+		sbi->max_blocks = MAX(sbi->max_bytes >> sbi->blocksize_bits, 1);
+
+	err = percpu_counter_init(&sbi->used_blocks, 0, GFP_KERNEL);
+	if (err)
+		return err;
+	err = percpu_counter_init(&sbi->used_inodes, 0, GFP_KERNEL);
+	if (err)
+		return err;
+
+	sbi->stats = alloc_percpu(struct myfs_io_stats);
+	if (!sbi->stats)
+		return -ENOMEM;
+
+	name = kasprintf(GFP_KERNEL, "myfs_block_%u:%u", MAJOR(sb->s_dev), MINOR(sb->s_dev));
+	if (!name)
+		return -ENOMEM;
+	err = myfs_pool_init(&sbi->pool, sbi->blocksize, name);
+	kfree(name);
+	if (err)
+		return err;
+
+	err = myfs_compress_init(sbi);
+	if (err)
+		return err;
+
+	err = myfs_share_init(sbi);
+	if (err)
+		return err;
+
+	err = myfs_swap_init(sb);
+	if (err)
+		return err;
+
+	myfs_debugfs_register(sb);
+
+	/* TODO 2/5: fill super_block
+	 *   - blocksize, blocksize_bits
+	 *   - magic
+	 *   - super operations
+	 *   - maxbytes
+	 */
+	sb->s_maxbytes = MAX_LFS_FILESIZE;
+	sb->s_blocksize = sbi->blocksize;
+	sb->s_blocksize_bits = sbi->blocksize_bits;
+	sb->s_magic = MYFS_MAGIC;
+	sb->s_op = &myfs_ops;
+	/* lets writers skip file_remove_privs() and take i_rwsem shared */
+	sb->s_flags |= SB_NOSEC;
+
+	/* A real bdi lets the flusher write back pages dirtied through mmap. */
+	err = super_setup_bdi(sb);
+	if (err)
+		return err;
+
+	/* mode = directory & access rights (755) */
+	root_inode = myfs_get_inode(sb, NULL,
+			S_IFDIR | S_IRWXU | S_IRGRP |
+			S_IXGRP | S_IROTH | S_IXOTH);
+
+	printk(LOG_LEVEL "root inode has %d link(s)\n", root_inode->i_nlink);
+
+	if (!root_inode)
+		return -ENOMEM;
+
+	root_dentry = d_make_root(root_inode);
+	if (!root_dentry)
+		goto out_no_root;
+	sb->s_root = root_dentry;
+
+	if (sbi->image)
+		return myfs_image_load(sb);
+
+	return 0;
+
+out_no_root:
+	iput(root_inode);
+	return -ENOMEM;
+}
+
+static struct dentry *myfs_mount(struct file_system_type *fs_type,
+		int flags, const char *dev_name, void *data)
+{
+	/* TODO 1/1: call superblock mount function */
+	return mount_nodev(fs_type, flags, data, myfs_fill_super);
+}
+
+/*
+ * Background passes that replace blocks of a file take its inode lock,
+ * invalidate lock and block_rwsem, which keeps out writers, read_folio and
+ * writepage. They only try, and leave mapped or dirty files alone: those
+ * are hot and would be written back behind their back.
+ */
+bool myfs_lock_blocks(struct inode *inode)
+{
+	struct address_space *mapping = inode->i_mapping;
+
+	if (!inode_trylock(inode))
+		return false;
+	if (!down_write_trylock(&mapping->invalidate_lock))
+		goto out_inode;
+	if (!down_write_trylock(&MYFS_I(inode)->block_rwsem))
+		goto out_mapping;
+
+	if (mapping_mapped(mapping) || mapping_tagged(mapping, PAGECACHE_TAG_DIRTY) ||
+	    mapping_tagged(mapping, PAGECACHE_TAG_WRITEBACK))
+		goto out_blocks;
+
+	return true;
+
+out_blocks:
+	up_write(&MYFS_I(inode)->block_rwsem);
+out_mapping:
+	filemap_invalidate_unlock(mapping);
+out_inode:
+	inode_unlock(inode);
+	return false;
+}
+
+void myfs_unlock_blocks(struct inode *inode)
+{
+	up_write(&MYFS_I(inode)->block_rwsem);
+	filemap_invalidate_unlock(inode->i_mapping);
+	inode_unlock(inode);
+}
+
+/* Call @fn on every regular file of the mount, with a reference held. */
+void myfs_for_each_inode(struct myfs_sb_info *sbi,
+		void (*fn)(struct inode *inode, void *arg), void *arg)
+{
+	struct myfs_inode_info *info;
+	struct inode *inode, *toput = NULL;
+
+	/* The reference keeps the inode on the list while the lock is dropped. */
+	spin_lock(&sbi->inodes_lock);
+	list_for_each_entry(info, &sbi->inodes, sb_list) {
+		inode = igrab(&info->vfs_inode);
+		if (!inode)
+			continue;
+		spin_unlock(&sbi->inodes_lock);
+
+		iput(toput);
+		toput = inode;
+
+		fn(inode, arg);
+		cond_resched();
+
+		spin_lock(&sbi->inodes_lock);
+	}
+	spin_unlock(&sbi->inodes_lock);
+	iput(toput);
+}
+
+/*
+ * Hand every block of the mount straight back to the backing allocator in
+ * bulk, before the inodes are evicted one by one. Nothing can reach the
+ * files anymore at this point, so no locking is needed beyond the list.
+ */
+static void myfs_release_storage(struct myfs_sb_info *sbi)
+{
+	struct myfs_inode_info *info;
+	void *batch[MYFS_MAGAZINE_SIZE];
+	unsigned int nr = 0;
+	unsigned long index;
+	long freed;
+	void *block;
+	LIST_HEAD(inodes);
+
+	spin_lock(&sbi->inodes_lock);
+	list_splice_init(&sbi->inodes, &inodes);
+	spin_unlock(&sbi->inodes_lock);
+
+	while (!list_empty(&inodes)) {
+		info = list_first_entry(&inodes, struct myfs_inode_info, sb_list);
+		list_del_init(&info->sb_list);
+
+		freed = 0;
+		xa_for_each(&info->blocks, index, block) {
+			if (xa_get_mark(&info->blocks, index, MYFS_MARK_SHARED) &&
+			    !myfs_block_put(sbi, block))
+				continue;
+			freed++;
+			if (myfs_entry_compressed(block)) {
+				myfs_free_compressed(sbi, block);
+				continue;
+			}
+			if (myfs_entry_swapped(block)) {
+				myfs_swap_free(sbi, block);
+				continue;
+			}
+			batch[nr++] = block;
+			if (nr == ARRAY_SIZE(batch)) {
+				myfs_pool_release_bulk(&sbi->pool, batch, nr);
+				nr = 0;
+			}
+		}
+		xa_destroy(&info->blocks);
+		atomic_long_set(&info->nr_blocks, 0);
+		myfs_unacct_blocks(sbi, freed);
+
+		cond_resched();
+	}
+
+	myfs_pool_release_bulk(&sbi->pool, batch, nr);
+}
+
+static void myfs_kill_sb(struct super_block *sb)
+{
+	struct myfs_sb_info *sbi = MYFS_SB(sb);
+
+	/* not after a failed mount, which would overwrite a good image */
+	if (sbi && sbi->image && (sb->s_flags & SB_ACTIVE))
+		myfs_image_dump(sb);
+
+	if (sbi) {
+		myfs_compress_exit(sbi);
+		myfs_share_stop(sbi);
+		myfs_swap_stop(sbi);
+	}
+
+	if (sbi && sbi->pool.mags)
+		myfs_release_storage(sbi);
+
+	kill_litter_super(sb);
+
+	if (sbi) {
+		debugfs_remove_recursive(sbi->debugfs_dir);
+		if (sbi->pool.mags)
+			myfs_share_exit(sbi);
+		myfs_swap_exit(sbi);
+		myfs_pool_destroy(&sbi->pool);
+		percpu_counter_destroy(&sbi->used_blocks);
+		percpu_counter_destroy(&sbi->used_inodes);
+		free_percpu(sbi->stats);
+		kfree(sbi->comp_alg);
+		kfree(sbi->image);
+		kfree(sbi->swap_path);
+		kfree(sbi);
+	}
+}
+
+/* TODO 1/6: define file_system_type structure */
+static struct file_system_type myfs_fs_type = {
+	.owner		= THIS_MODULE,
+	.name		= "myfs",
+	.mount		= myfs_mount,
+	.kill_sb	= myfs_kill_sb,
+};
+
+static int __init myfs_init(void)
+{
+	int err;
+
+	myfs_inline_size = MIN(myfs_inline_size, MYFS_INLINE_MAX);
+	myfs_inode_cachep = kmem_cache_create("myfs_inode_cache",
+			sizeof(struct myfs_inode_info) + myfs_inline_size, 0,
+			SLAB_RECLAIM_ACCOUNT | SLAB_MEM_SPREAD | SLAB_ACCOUNT,
+			myfs_inode_init_once);
+	if (!myfs_inode_cachep)
+		return -ENOMEM;
+
+	myfs_debugfs_root = debugfs_create_dir("myfs", NULL);
+
+	/* TODO 1/1: register */
+	err = register_filesystem(&myfs_fs_type);
+	if (err)
+		goto out;
+	err = register_filesystem(&myfs_disk_fs_type);
+	if (err) {
+		unregister_filesystem(&myfs_fs_type);
+		goto out;
+	}
+
+	return 0;
+
+out:
+	printk(LOG_LEVEL "myfs: register_filesystem failed\n");
+	debugfs_remove_recursive(myfs_debugfs_root);
+	kmem_cache_destroy(myfs_inode_cachep);
+
+	return err;
+}
+
+static void __exit myfs_exit(void)
+{
+	unregister_filesystem(&myfs_disk_fs_type);
+	unregister_filesystem(&myfs_fs_type);
+	debugfs_remove_recursive(myfs_debugfs_root);
+
+	/* Make sure all delayed rcu free inodes are flushed. */
+	rcu_barrier();
+	kmem_cache_destroy(myfs_inode_cachep);
+}
+
+module_init(myfs_init);
+module_exit(myfs_exit);
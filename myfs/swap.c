@@ -0,0 +1,341 @@
+/*
+ * Swapping cold blocks out to a backing file.
+ *
+ * With swap=<path> a shrinker moves blocks that have not been accessed
+ * since its previous pass to slots of the given file or block device,
+ * which has to be sized up front, and gives their memory back to the
+ * system. The xarray entry of a swapped block encodes its slot, tagged
+ * MYFS_ENTRY_SWAPPED, and the block is read back into a pool block on the
+ * next access, like a compressed one. Swap-out holds write access to the
+ * backing file and skips a pass while the filesystem it is on is frozen.
+ *
+ * Blocks are written and read with direct I/O straight from and into the
+ * pool blocks, so swapping does not fill the page cache of the backing
+ * file with the memory it is trying to free. Swap-out runs under
+ * myfs_lock_blocks(); swap-in races only with other readers, and the
+ * xa_cmpxchg decides whose copy is installed. A loser may have read a
+ * slot that was freed and reused meanwhile, but then finds the entry
+ * changed and throws its copy away.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/bvec.h>
+#include <linux/uio.h>
+#include <linux/shrinker.h>
+#include <linux/seq_file.h>
+
+#include "myfs.h"
+
+/* pages per direct I/O call */
+#define MYFS_SWAP_IO_PAGES	16
+
+static struct page *myfs_block_page(void *addr)
+{
+	return is_vmalloc_addr(addr) ? vmalloc_to_page(addr) : virt_to_page(addr);
+}
+
+static int myfs_swap_io(struct myfs_sb_info *sbi, char *block, unsigned long slot, int rw)
+{
+	struct bio_vec bvec[MYFS_SWAP_IO_PAGES];
+	loff_t pos = (loff_t)slot << sbi->blocksize_bits;
+	unsigned int done = 0, nr, i;
+	struct iov_iter iter;
+	ssize_t ret;
+
+	while (done < sbi->blocksize) {
+		nr = min_t(unsigned int, (sbi->blocksize - done) >> PAGE_SHIFT,
+			   MYFS_SWAP_IO_PAGES);
+		for (i = 0; i < nr; i++) {
+			bvec[i].bv_page = myfs_block_page(block + done + i * PAGE_SIZE);
+			bvec[i].bv_len = PAGE_SIZE;
+			bvec[i].bv_offset = 0;
+		}
+		iov_iter_bvec(&iter, rw, bvec, nr, nr << PAGE_SHIFT);
+
+		/* writes come from myfs_swap_scan(), which holds write access */
+		if (rw == WRITE)
+			ret = vfs_iter_write(sbi->swap_file, &iter, &pos, 0);
+		else
+			ret = vfs_iter_read(sbi->swap_file, &iter, &pos, 0);
+		if (ret != nr << PAGE_SHIFT)
+			return ret < 0 ? ret : -EIO;
+
+		done += nr << PAGE_SHIFT;
+	}
+
+	return 0;
+}
+
+static long myfs_swap_alloc_slot(struct myfs_sb_info *sbi)
+{
+	unsigned long slot;
+
+	spin_lock(&sbi->swap_lock);
+	slot = find_next_zero_bit(sbi->swap_map, sbi->swap_slots, sbi->swap_next);
+	if (slot >= sbi->swap_slots)
+		slot = find_first_zero_bit(sbi->swap_map, sbi->swap_slots);
+	if (slot < sbi->swap_slots) {
+		__set_bit(slot, sbi->swap_map);
+		sbi->swap_next = slot + 1;
+		atomic_long_inc(&sbi->swap_stats.nr_swapped);
+	}
+	spin_unlock(&sbi->swap_lock);
+
+	return slot < sbi->swap_slots ? slot : -ENOSPC;
+}
+
+static void myfs_swap_free_slot(struct myfs_sb_info *sbi, unsigned long slot)
+{
+	spin_lock(&sbi->swap_lock);
+	__clear_bit(slot, sbi->swap_map);
+	spin_unlock(&sbi->swap_lock);
+	atomic_long_dec(&sbi->swap_stats.nr_swapped);
+}
+
+void myfs_swap_free(struct myfs_sb_info *sbi, void *entry)
+{
+	myfs_swap_free_slot(sbi, myfs_swap_slot(entry));
+}
+
+/*
+ * Replace the swapped block at @index with a copy read back from its slot.
+ * Returns whatever plain entry ends up there, which is NULL if the block
+ * was punched out in the meantime.
+ */
+char *myfs_swap_in(struct inode *inode, unsigned long index)
+{
+	struct myfs_inode_info *info = MYFS_I(inode);
+	struct myfs_sb_info *sbi = MYFS_SB(inode->i_sb);
+	void *entry, *old;
+	char *block;
+	int err;
+
+	entry = xa_load(&info->blocks, index);
+	while (myfs_entry_swapped(entry)) {
+		block = myfs_pool_alloc(&sbi->pool);
+		if (!block)
+			return ERR_PTR(-ENOMEM);
+
+		err = myfs_swap_io(sbi, block, myfs_swap_slot(entry), READ);
+		if (err) {
+			myfs_pool_free(&sbi->pool, block);
+			atomic_long_inc(&sbi->swap_stats.errors);
+			return ERR_PTR(err);
+		}
+
+		old = xa_cmpxchg(&info->blocks, index, entry, block, GFP_NOFS);
+		if (old == entry) {
+			myfs_swap_free(sbi, entry);
+			atomic_long_inc(&sbi->swap_stats.swapins);
+			return block;
+		}
+
+		myfs_pool_free(&sbi->pool, block);
+		if (xa_is_err(old))
+			return ERR_PTR(xa_err(old));
+		entry = old;
+	}
+
+	return entry;
+}
+
+struct myfs_swap_scan {
+	struct myfs_sb_info *sbi;
+	unsigned long nr_to_scan;
+	unsigned long freed;
+	void *batch[MYFS_MAGAZINE_SIZE];
+	unsigned int nr;
+};
+
+static bool myfs_swap_out_block(struct myfs_swap_scan *scan, struct myfs_inode_info *info,
+		unsigned long index, char *block)
+{
+	struct myfs_sb_info *sbi = scan->sbi;
+	long slot;
+	void *old;
+
+	slot = myfs_swap_alloc_slot(sbi);
+	if (slot < 0)
+		return false;
+
+	if (myfs_swap_io(sbi, block, slot, WRITE)) {
+		myfs_swap_free_slot(sbi, slot);
+		atomic_long_inc(&sbi->swap_stats.errors);
+		return false;
+	}
+
+	old = xa_cmpxchg(&info->blocks, index, block, myfs_swap_entry(slot), GFP_NOFS);
+	if (old != block) {
+		myfs_swap_free_slot(sbi, slot);
+		return true;
+	}
+
+	/* straight back to the system, the magazines would keep it */
+	scan->batch[scan->nr++] = block;
+	if (scan->nr == ARRAY_SIZE(scan->batch)) {
+		myfs_pool_release_bulk(&sbi->pool, scan->batch, scan->nr);
+		scan->nr = 0;
+	}
+	scan->freed++;
+	atomic_long_inc(&sbi->swap_stats.swapouts);
+
+	return true;
+}
+
+static void myfs_swap_out_inode(struct inode *inode, void *arg)
+{
+	struct myfs_swap_scan *scan = arg;
+	struct myfs_sb_info *sbi = scan->sbi;
+	struct myfs_inode_info *info = MYFS_I(inode);
+	unsigned long index;
+	void *entry;
+
+	if (scan->freed >= scan->nr_to_scan || !myfs_lock_blocks(inode))
+		return;
+
+	xa_for_each(&info->blocks, index, entry) {
+		if (myfs_entry_offline(entry) ||
+		    xa_get_mark(&info->blocks, index, MYFS_MARK_SHARED))
+			continue;
+
+		if (xa_get_mark(&info->blocks, index, MYFS_MARK_REFERENCED))
+			xa_clear_mark(&info->blocks, index, MYFS_MARK_REFERENCED);
+		else if (!myfs_swap_out_block(scan, info, index, entry))
+			break;
+
+		if (scan->freed >= scan->nr_to_scan)
+			break;
+	}
+
+	myfs_unlock_blocks(inode);
+}
+
+static unsigned long myfs_swap_count(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct myfs_sb_info *sbi = container_of(shrinker, struct myfs_sb_info, swap_shrinker);
+	long resident;
+
+	if (atomic_long_read(&sbi->swap_stats.nr_swapped) >= sbi->swap_slots)
+		return 0;
+
+	resident = percpu_counter_read_positive(&sbi->used_blocks) -
+		   atomic_long_read(&sbi->swap_stats.nr_swapped) -
+		   atomic_long_read(&sbi->comp_stats.nr_compressed);
+
+	return resident > 0 ? resident : 0;
+}
+
+/*
+ * file_start_write() for the backing file, but reclaim must not wait for a
+ * frozen filesystem to thaw: it only tries. A block device needs nothing.
+ */
+static bool myfs_swap_start_write(struct file *file)
+{
+	struct inode *inode = file_inode(file);
+
+	return !S_ISREG(inode->i_mode) || sb_start_write_trylock(inode->i_sb);
+}
+
+/*
+ * Writing to the backing file needs both I/O and filesystem recursion, and
+ * is held off while the filesystem holding it is frozen.
+ */
+static unsigned long myfs_swap_scan(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct myfs_sb_info *sbi = container_of(shrinker, struct myfs_sb_info, swap_shrinker);
+	struct myfs_swap_scan scan = {
+		.sbi		= sbi,
+		.nr_to_scan	= sc->nr_to_scan,
+	};
+
+	if ((sc->gfp_mask & (__GFP_IO | __GFP_FS)) != (__GFP_IO | __GFP_FS))
+		return SHRINK_STOP;
+	if (!myfs_swap_start_write(sbi->swap_file))
+		return SHRINK_STOP;
+
+	myfs_for_each_inode(sbi, myfs_swap_out_inode, &scan);
+	file_end_write(sbi->swap_file);
+	myfs_pool_release_bulk(&sbi->pool, scan.batch, scan.nr);
+
+	return scan.freed ?: SHRINK_STOP;
+}
+
+void myfs_swap_show(struct seq_file *m, struct myfs_sb_info *sbi)
+{
+	struct myfs_swap_stats *stats = &sbi->swap_stats;
+	unsigned int pages = sbi->blocksize >> PAGE_SHIFT;
+
+	seq_printf(m, "file:           %s\n", sbi->swap_path ?: "none");
+	seq_printf(m, "slots:          %lu\n", sbi->swap_slots);
+	seq_printf(m, "swapped_blocks: %ld\n", atomic_long_read(&stats->nr_swapped));
+	seq_printf(m, "swapouts:       %ld\n", atomic_long_read(&stats->swapouts));
+	seq_printf(m, "swapins:        %ld\n", atomic_long_read(&stats->swapins));
+	seq_printf(m, "pages_out:      %ld\n", atomic_long_read(&stats->swapouts) * pages);
+	seq_printf(m, "pages_in:       %ld\n", atomic_long_read(&stats->swapins) * pages);
+	seq_printf(m, "errors:         %ld\n", atomic_long_read(&stats->errors));
+}
+
+int myfs_swap_init(struct super_block *sb)
+{
+	struct myfs_sb_info *sbi = MYFS_SB(sb);
+	struct file *file;
+	int err;
+
+	if (!sbi->swap_path)
+		return 0;
+
+	spin_lock_init(&sbi->swap_lock);
+
+	file = filp_open(sbi->swap_path, O_RDWR | O_LARGEFILE | O_DIRECT, 0);
+	if (IS_ERR(file)) {
+		pr_err("myfs: cannot open swap file '%s' for direct I/O: %ld\n",
+		       sbi->swap_path, PTR_ERR(file));
+		return PTR_ERR(file);
+	}
+	sbi->swap_file = file;
+
+	sbi->swap_slots = i_size_read(file->f_mapping->host) >> sbi->blocksize_bits;
+	if (!sbi->swap_slots) {
+		pr_err("myfs: swap file '%s' is smaller than a block\n", sbi->swap_path);
+		return -EINVAL;
+	}
+
+	sbi->swap_map = bitmap_zalloc(sbi->swap_slots, GFP_KERNEL);
+	if (!sbi->swap_map)
+		return -ENOMEM;
+
+	sbi->swap_shrinker.count_objects = myfs_swap_count;
+	sbi->swap_shrinker.scan_objects = myfs_swap_scan;
+	sbi->swap_shrinker.seeks = DEFAULT_SEEKS;
+	err = register_shrinker(&sbi->swap_shrinker, "myfs-swap:%u:%u",
+				MAJOR(sb->s_dev), MINOR(sb->s_dev));
+	if (err)
+		return err;
+	sbi->swap_registered = true;
+
+	return 0;
+}
+
+/* No more swap-outs from here on. */
+void myfs_swap_stop(struct myfs_sb_info *sbi)
+{
+	if (sbi->swap_registered) {
+		unregister_shrinker(&sbi->swap_shrinker);
+		sbi->swap_registered = false;
+	}
+}
+
+/* Swapped blocks have been released with the rest of the storage by now. */
+void myfs_swap_exit(struct myfs_sb_info *sbi)
+{
+	myfs_swap_stop(sbi);
+
+	bitmap_free(sbi->swap_map);
+	sbi->swap_map = NULL;
+	if (sbi->swap_file)
+		filp_close(sbi->swap_file, NULL);
+	sbi->swap_file = NULL;
+}
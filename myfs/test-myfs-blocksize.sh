@@ -0,0 +1,33 @@
+#!/bin/sh
+
+set -ex
+
+# load module
+insmod myfs.ko
+mkdir -p /mnt/myfs
+
+# invalid block sizes are rejected
+! mount -t myfs -o blocksize=128 none /mnt/myfs
+! mount -t myfs -o blocksize=3K none /mnt/myfs
+! mount -t myfs -o blocksize=4M none /mnt/myfs
+
+for bs in 4K 64K 2M; do
+	mount -t myfs -o blocksize=$bs none /mnt/myfs
+	cat /proc/mounts | grep myfs
+	stat -f /mnt/myfs
+
+	dd if=/dev/urandom of=/tmp/myfs-rnd bs=1M count=20
+	dd if=/tmp/myfs-rnd of=/mnt/myfs/rnd bs=1M
+	[ "$(sha256sum < /tmp/myfs-rnd)" = "$(sha256sum < /mnt/myfs/rnd)" ]
+
+	# unaligned write in the middle of a block
+	printf 'myfs' | dd of=/mnt/myfs/rnd bs=1 seek=5000 conv=notrunc
+	dd if=/mnt/myfs/rnd bs=1 skip=5000 count=4 2>/dev/null | grep -q myfs
+
+	umount /mnt/myfs
+done
+
+rm -f /tmp/myfs-rnd
+
+# unload module
+rmmod myfs
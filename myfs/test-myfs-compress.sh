@@ -0,0 +1,32 @@
+#!/bin/sh
+
+set -ex
+
+# load module
+insmod myfs.ko
+mkdir -p /mnt/myfs
+mount -t myfs -o compress=lz4,compress_age=1 none /mnt/myfs
+cd /mnt/myfs
+
+# compressible data, dropped from the page cache so reads hit the blocks
+yes "myfs compression test line" | head -c 16M > log
+sum=$(sha256sum log | cut -d' ' -f1)
+echo 1 > /proc/sys/vm/drop_caches
+
+# two passes of the worker: the first clears the access marks
+sleep 3
+cat /sys/kernel/debug/myfs/*/compression
+[ "$(awk '/compressed_blocks/ { print $2 }' /sys/kernel/debug/myfs/*/compression)" -gt 0 ]
+
+# reads decompress transparently
+[ "$(sha256sum log | cut -d' ' -f1)" = "$sum" ]
+[ "$(awk '/decompressions/ { print $2 }' /sys/kernel/debug/myfs/*/compression)" -gt 0 ]
+
+rm -f log
+
+# unmount filesystem
+cd ..
+umount /mnt/myfs
+
+# unload module
+rmmod myfs
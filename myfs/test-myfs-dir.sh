@@ -0,0 +1,43 @@
+#!/bin/sh
+
+set -ex
+
+# load module
+insmod myfs.ko
+mkdir -p /mnt/myfs
+mount -t myfs none /mnt/myfs
+cd /mnt/myfs
+
+# a large directory lists every entry exactly once
+mkdir big
+(cd big && seq 1 100000 | xargs touch)
+[ "$(ls big | wc -l)" -eq 100000 ]
+[ "$(ls big | sort -u | wc -l)" -eq 100000 ]
+
+# entries created after a listing show up in the next one
+touch big/late
+[ "$(ls big | wc -l)" -eq 100001 ]
+
+# rmdir only succeeds once the directory is empty
+if rmdir big; then exit 1; fi
+mkdir a b
+touch a/f b/g
+if mv -T a b; then exit 1; fi
+
+# rename moves the entry between directory indexes
+mv a/f b/f
+[ "$(ls a | wc -l)" -eq 0 ]
+[ "$(ls b)" = "$(printf 'f\ng')" ]
+mv a b/
+[ -d b/a ]
+[ "$(stat -c %h b)" -eq 3 ]
+
+rm -r big b
+[ "$(ls | wc -l)" -eq 0 ]
+
+# unmount filesystem
+cd ..
+umount /mnt/myfs
+
+# unload module
+rmmod myfs
@@ -0,0 +1,51 @@
+#!/bin/sh
+
+set -ex
+
+# load module
+insmod myfs.ko
+mkdir -p /mnt/myfs
+mount -t myfs none /mnt/myfs
+cd /mnt/myfs
+
+# direct writes and reads see the same data as buffered ones
+dd if=/dev/urandom of=/tmp/myfs-direct bs=1M count=16
+dd if=/tmp/myfs-direct of=file bs=1M oflag=direct
+cmp /tmp/myfs-direct file
+dd if=file of=copy bs=1M iflag=direct
+cmp /tmp/myfs-direct copy
+
+# unaligned direct I/O and reads past EOF
+dd if=/tmp/myfs-direct of=small bs=1000 count=3 oflag=direct
+[ "$(stat -c %s small)" -eq 3000 ]
+[ "$(dd if=small bs=4096 iflag=direct | wc -c)" -eq 3000 ]
+
+# a direct write lands on data cached by an earlier buffered read
+cat file > /dev/null
+dd if=/dev/zero of=file bs=4K count=1 seek=1 conv=notrunc oflag=direct
+[ "$(dd if=file bs=4K skip=1 count=1 | tr -d '\0' | wc -c)" -eq 0 ]
+
+# many queued async requests, when fio is around
+if command -v fio > /dev/null; then
+	fio --name=aio --directory=/mnt/myfs --size=64M --bs=256k --direct=1 \
+	    --ioengine=libaio --iodepth=32 --rw=randrw --verify=crc32c
+
+	# async direct writes drop what buffered reads cached meanwhile
+	dd if=/dev/zero of=aio bs=1M count=4
+	(while [ ! -e aio-done ]; do cat aio > /dev/null; done) &
+	fio --name=aio --filename=/mnt/myfs/aio --size=4M --bs=64k --direct=1 \
+	    --ioengine=libaio --iodepth=16 --rw=write --buffer_pattern=0xab
+	touch aio-done
+	wait
+	[ "$(tr -d '\253' < aio | wc -c)" -eq 0 ]
+	rm -f aio aio-done
+fi
+
+rm -f file copy small /tmp/myfs-direct
+
+# unmount filesystem
+cd ..
+umount /mnt/myfs
+
+# unload module
+rmmod myfs
@@ -0,0 +1,57 @@
+#!/bin/sh
+
+set -ex
+
+DEV=/dev/ram0
+
+# load modules, format a 256M RAM disk
+insmod myfs.ko
+modprobe brd rd_nr=1 rd_size=262144
+user/mkfs-myfs $DEV
+mkdir -p /mnt/myfs
+mount -t myfs_disk $DEV /mnt/myfs
+cd /mnt/myfs
+
+# a tree with small, large, sparse and hard-linked files
+mkdir -p a/b/c
+echo small > a/small
+dd if=/dev/urandom of=a/b/big bs=1M count=32
+dd if=/dev/urandom of=a/b/c/sparse bs=4K count=1 seek=1000
+ln a/b/big a/big.link
+chmod 0600 a/small
+sums=$(sha256sum a/small a/b/big a/b/c/sparse)
+
+# everything survives a remount
+cd ..
+umount /mnt/myfs
+mount -t myfs_disk $DEV /mnt/myfs
+cd /mnt/myfs
+[ "$(sha256sum a/small a/b/big a/b/c/sparse)" = "$sums" ]
+[ "$(stat -c %a a/small)" = 600 ]
+[ "$(stat -c %h a/b/big)" -eq 2 ]
+[ "$(stat -c %i a/b/big)" = "$(stat -c %i a/big.link)" ]
+[ "$(stat -c %s a/b/c/sparse)" -eq $((1001 * 4096)) ]
+[ "$(stat -c %b a/b/c/sparse)" -le 8 ]
+[ "$(stat -c %h a/b)" -eq 3 ]
+
+# O_DIRECT and buffered reads see the same data
+[ "$(dd if=a/b/big bs=1M iflag=direct | sha256sum)" = "$(sha256sum < a/b/big)" ]
+
+# removed files give their blocks back, also after a remount
+free=$(stat -f -c %f .)
+rm -r a
+[ "$(stat -f -c %f .)" -gt "$free" ]
+sync
+free=$(stat -f -c %f .)
+cd ..
+umount /mnt/myfs
+mount -t myfs_disk $DEV /mnt/myfs
+[ "$(stat -f -c %f /mnt/myfs)" -eq "$free" ]
+[ -z "$(ls /mnt/myfs)" ]
+
+# unmount filesystem
+umount /mnt/myfs
+
+# unload modules
+rmmod brd
+rmmod myfs
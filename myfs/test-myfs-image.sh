@@ -0,0 +1,56 @@
+#!/bin/sh
+
+set -ex
+
+IMAGE=/tmp/myfs.img
+
+# load module
+insmod myfs.ko
+mkdir -p /mnt/myfs
+rm -f $IMAGE
+mount -t myfs -o image=$IMAGE none /mnt/myfs
+cd /mnt/myfs
+
+# a tree with small, large, sparse and hard-linked files
+mkdir -p a/b/c
+echo small > a/small
+dd if=/dev/urandom of=a/b/big bs=1M count=8
+dd if=/dev/urandom of=a/b/c/sparse bs=4K count=1 seek=1000
+ln a/b/big a/big.link
+chmod 0600 a/small
+sums=$(sha256sum a/small a/b/big a/b/c/sparse)
+
+# the image is written at umount
+cd ..
+umount /mnt/myfs
+[ -s $IMAGE ]
+
+# and loaded back at mount
+mount -t myfs -o image=$IMAGE none /mnt/myfs
+cd /mnt/myfs
+[ "$(sha256sum a/small a/b/big a/b/c/sparse)" = "$sums" ]
+[ "$(stat -c %a a/small)" = 600 ]
+[ "$(stat -c %h a/b/big)" -eq 2 ]
+[ "$(stat -c %i a/b/big)" = "$(stat -c %i a/big.link)" ]
+[ "$(stat -c %s a/b/c/sparse)" -eq $((1001 * 4096)) ]
+[ "$(stat -c %b a/b/c/sparse)" -lt 100 ]
+[ "$(stat -c %h a/b)" -eq 3 ]
+
+# changes after the load make it into the next image
+rm -r a/b/c
+echo more >> a/small
+cd ..
+umount /mnt/myfs
+mount -t myfs -o image=$IMAGE none /mnt/myfs
+[ ! -e /mnt/myfs/a/b/c ]
+[ "$(tail -n1 /mnt/myfs/a/small)" = more ]
+
+# a corrupt image fails the mount and is left alone
+umount /mnt/myfs
+head -c 1000 $IMAGE > $IMAGE.bad
+if mount -t myfs -o image=$IMAGE.bad none /mnt/myfs; then exit 1; fi
+[ "$(stat -c %s $IMAGE.bad)" -eq 1000 ]
+rm -f $IMAGE $IMAGE.bad
+
+# unload module
+rmmod myfs
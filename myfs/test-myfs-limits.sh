@@ -0,0 +1,33 @@
+#!/bin/sh
+
+set -ex
+
+# load module
+insmod myfs.ko
+mkdir -p /mnt/myfs
+mount -t myfs -o size=8M,nr_inodes=16 none /mnt/myfs
+grep myfs /proc/mounts | grep -q "size=8192k,nr_inodes=16"
+cd /mnt/myfs
+
+# statfs reports the configured capacity
+[ "$(stat -f -c %b .)" -eq 2048 ]
+[ "$(stat -f -c %c .)" -eq 16 ]
+
+# writing past the limit fails with ENOSPC and rm gives the space back
+if dd if=/dev/zero of=fill bs=1M count=16; then exit 1; fi
+[ "$(stat -f -c %f .)" -eq 0 ]
+rm fill
+[ "$(stat -f -c %f .)" -eq 2048 ]
+
+# the root directory counts against nr_inodes
+for i in $(seq 1 15); do touch f$i; done
+if touch f16; then exit 1; fi
+[ "$(stat -f -c %d .)" -eq 0 ]
+rm -f f*
+
+# unmount filesystem
+cd ..
+umount /mnt/myfs
+
+# unload module
+rmmod myfs
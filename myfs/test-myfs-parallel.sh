@@ -0,0 +1,31 @@
+#!/bin/sh
+
+set -ex
+
+# load module
+insmod myfs.ko
+mkdir -p /mnt/myfs
+mount -t myfs none /mnt/myfs
+
+# in-place writers to disjoint regions of one file run in parallel
+make -C user
+user/pwrite-bench -s 256 -b 64 -p 4 /mnt/myfs/bench 1 2 4 8
+rm /mnt/myfs/bench
+
+# concurrent in-place writers each leave their own region intact
+truncate -s 32M /mnt/myfs/file
+for i in 0 1 2 3 4 5 6 7; do
+	yes $i | head -c 4M | dd of=/mnt/myfs/file bs=1M seek=$((i * 4)) conv=notrunc &
+done
+wait
+for i in 0 1 2 3 4 5 6 7; do
+	[ "$(dd if=/mnt/myfs/file bs=1M skip=$((i * 4)) count=4 | sha256sum)" = \
+	  "$(yes $i | head -c 4M | sha256sum)" ]
+done
+rm /mnt/myfs/file
+
+# unmount filesystem
+umount /mnt/myfs
+
+# unload module
+rmmod myfs
@@ -0,0 +1,53 @@
+#!/bin/sh
+
+set -ex
+
+# load module
+insmod myfs.ko
+mkdir -p /mnt/myfs
+mount -t myfs none /mnt/myfs
+cd /mnt/myfs
+
+# a write far past EOF only allocates the written block
+dd if=/dev/urandom of=sparse bs=4K count=1 seek=262144
+[ "$(stat -c %s sparse)" -eq $((262145 * 4096)) ]
+[ "$(du -k sparse | cut -f1)" -le 4 ]
+dd if=sparse bs=4K count=1 skip=1000 2>/dev/null | cmp -s -n 4096 - /dev/zero
+
+# shrinking truncate gives memory back and extending reads back zeros
+dd if=/dev/urandom of=big bs=1M count=16
+[ "$(du -k big | cut -f1)" -ge 16384 ]
+truncate -s 6000 big
+[ "$(du -k big | cut -f1)" -le 8 ]
+truncate -s 1M big
+dd if=big bs=1 skip=6000 count=2192 2>/dev/null | cmp -s -n 2192 - /dev/zero
+
+# punch a hole in the middle of a file
+dd if=/dev/urandom of=holes bs=1M count=8
+fallocate -p -o 1M -l 4M holes
+[ "$(stat -c %s holes)" -eq $((8 * 1024 * 1024)) ]
+[ "$(du -k holes | cut -f1)" -le 4096 ]
+dd if=holes bs=1M count=4 skip=1 2>/dev/null | cmp -s -n 4194304 - /dev/zero
+
+# preallocate without changing the size
+fallocate -n -l 1M prealloc
+[ "$(stat -c %s prealloc)" -eq 0 ]
+[ "$(du -k prealloc | cut -f1)" -ge 1024 ]
+
+# tiny files live in the inode and move to blocks once they grow
+echo 12345 > pid
+[ "$(stat -c %b pid)" -eq 0 ]
+[ "$(cat pid)" = 12345 ]
+dd if=/dev/urandom of=pid bs=1K count=8 seek=1 conv=notrunc
+[ "$(stat -c %b pid)" -gt 0 ]
+[ "$(head -c 6 pid)" = "$(printf '12345\n')" ]
+
+rm -f sparse big holes prealloc pid
+cat /sys/kernel/debug/myfs/*/blockpool
+
+# unmount filesystem
+cd ..
+umount /mnt/myfs
+
+# unload module
+rmmod myfs
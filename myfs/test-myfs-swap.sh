@@ -0,0 +1,42 @@
+#!/bin/sh
+
+set -ex
+
+SWAP=/var/tmp/myfs.swap
+
+# load module
+insmod myfs.ko
+mkdir -p /mnt/myfs
+rm -f $SWAP
+fallocate -l 64M $SWAP
+mount -t myfs -o swap=$SWAP none /mnt/myfs
+cd /mnt/myfs
+
+# data dropped from the page cache so only the blocks hold it
+dd if=/dev/urandom of=cold bs=1M count=32
+sum=$(sha256sum cold | cut -d' ' -f1)
+echo 1 > /proc/sys/vm/drop_caches
+
+# two shrinker passes: the first clears the access marks
+echo 2 > /proc/sys/vm/drop_caches
+echo 2 > /proc/sys/vm/drop_caches
+cat /sys/kernel/debug/myfs/*/swap
+[ "$(awk '/swapouts/ { print $2 }' /sys/kernel/debug/myfs/*/swap)" -gt 0 ]
+
+# reads swap the blocks back in
+[ "$(sha256sum cold | cut -d' ' -f1)" = "$sum" ]
+[ "$(awk '/swapins/ { print $2 }' /sys/kernel/debug/myfs/*/swap)" -gt 0 ]
+
+# removing the file frees its slots
+echo 2 > /proc/sys/vm/drop_caches
+echo 2 > /proc/sys/vm/drop_caches
+rm -f cold
+[ "$(awk '/swapped_blocks/ { print $2 }' /sys/kernel/debug/myfs/*/swap)" -eq 0 ]
+
+# unmount filesystem
+cd ..
+umount /mnt/myfs
+rm -f $SWAP
+
+# unload module
+rmmod myfs
@@ -18,6 +18,9 @@ cat /proc/mounts | grep myfs
 #show filesystem statistics
 stat -f /mnt/myfs
 
+#show block pool statistics
+cat /sys/kernel/debug/myfs/*/blockpool
+
 #list all filesystem files
 cd /mnt/myfs
 ls -la
@@ -0,0 +1,161 @@
+/*
+ * Format a block device or an image file for myfs_disk.
+ *
+ * Writes the superblock, both bitmaps and an inode table holding only the
+ * root directory; the data area is left as it is. By default there is one
+ * inode per 16K of space.
+ *
+ * Usage: mkfs-myfs [-i inodes] device
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <endian.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include "../myfs_disk.h"
+
+#define BITS_PER_BLOCK		(MYFS_DISK_BLOCKSIZE * 8)
+#define INODES_PER_BLOCK	(MYFS_DISK_BLOCKSIZE / MYFS_DISK_INODE_SIZE)
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+
+static char block[MYFS_DISK_BLOCKSIZE];
+
+static void write_block(int fd, uint64_t nr)
+{
+	if (pwrite(fd, block, sizeof(block), nr * MYFS_DISK_BLOCKSIZE) != sizeof(block)) {
+		perror("pwrite");
+		exit(1);
+	}
+}
+
+/*
+ * Write a bitmap of nbits bits with the first used ones set, as well as
+ * the padding past nbits up to the end of its last block.
+ */
+static void write_bitmap(int fd, uint32_t start, uint32_t nr, uint64_t nbits, uint64_t used)
+{
+	uint64_t bit, first;
+	uint32_t i;
+
+	for (i = 0; i < nr; i++) {
+		memset(block, 0, sizeof(block));
+		first = (uint64_t)i * BITS_PER_BLOCK;
+		for (bit = first; bit < first + BITS_PER_BLOCK; bit++)
+			if (bit < used || bit >= nbits)
+				block[(bit - first) / 8] |= 1 << (bit % 8);
+		write_block(fd, start + i);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct myfs_disk_super *super = (void *)block;
+	struct myfs_disk_inode *root;
+	uint64_t size, nr_blocks, nr_inodes = 0;
+	uint32_t nr_imap, nr_bmap, inode_table, data_start, i;
+	struct stat st;
+	time_t now = time(NULL);
+	int fd, opt;
+
+	while ((opt = getopt(argc, argv, "i:")) != -1) {
+		switch (opt) {
+		case 'i':
+			nr_inodes = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc - 1)
+		goto usage;
+
+	fd = open(argv[optind], O_RDWR);
+	if (fd < 0 || fstat(fd, &st)) {
+		perror(argv[optind]);
+		return 1;
+	}
+	if (S_ISBLK(st.st_mode)) {
+		if (ioctl(fd, BLKGETSIZE64, &size)) {
+			perror("BLKGETSIZE64");
+			return 1;
+		}
+	} else {
+		size = st.st_size;
+	}
+
+	nr_blocks = size / MYFS_DISK_BLOCKSIZE;
+	if (nr_blocks > UINT32_MAX)
+		nr_blocks = UINT32_MAX;
+	if (!nr_inodes)
+		nr_inodes = nr_blocks / 4;
+	if (nr_inodes < 16)
+		nr_inodes = 16;
+	if (nr_inodes > UINT32_MAX)
+		nr_inodes = UINT32_MAX;
+
+	nr_imap = DIV_ROUND_UP(nr_inodes, BITS_PER_BLOCK);
+	nr_bmap = DIV_ROUND_UP(nr_blocks, BITS_PER_BLOCK);
+	inode_table = 1 + nr_imap + nr_bmap;
+	data_start = inode_table + DIV_ROUND_UP(nr_inodes, INODES_PER_BLOCK);
+	if (data_start >= nr_blocks) {
+		fprintf(stderr, "%s: too small for %llu inodes\n", argv[optind],
+			(unsigned long long)nr_inodes);
+		return 1;
+	}
+
+	/* a stale superblock must not outlive an interrupted run */
+	write_block(fd, 0);
+	write_bitmap(fd, 1, nr_imap, nr_inodes, MYFS_DISK_ROOT_INO + 1);
+	write_bitmap(fd, 1 + nr_imap, nr_bmap, nr_blocks, data_start);
+
+	for (i = inode_table; i < data_start; i++) {
+		memset(block, 0, sizeof(block));
+		if (i == inode_table + MYFS_DISK_ROOT_INO / INODES_PER_BLOCK) {
+			root = (void *)block +
+			       (MYFS_DISK_ROOT_INO % INODES_PER_BLOCK) * MYFS_DISK_INODE_SIZE;
+			root->mode = htole16(S_IFDIR | 0755);
+			root->nlink = htole16(2);
+			root->uid = htole32(getuid());
+			root->gid = htole32(getgid());
+			root->atime = root->mtime = root->ctime = htole64(now);
+		}
+		write_block(fd, i);
+	}
+
+	/* the superblock goes last, once everything it describes is there */
+	memset(block, 0, sizeof(block));
+	super->magic = htole32(MYFS_DISK_MAGIC);
+	super->version = htole32(MYFS_DISK_VERSION);
+	super->blocksize = htole32(MYFS_DISK_BLOCKSIZE);
+	super->inode_size = htole32(MYFS_DISK_INODE_SIZE);
+	super->nr_blocks = htole32(nr_blocks);
+	super->nr_inodes = htole32(nr_inodes);
+	super->inode_bitmap = htole32(1);
+	super->block_bitmap = htole32(1 + nr_imap);
+	super->inode_table = htole32(inode_table);
+	super->data_start = htole32(data_start);
+	write_block(fd, 0);
+
+	if (fsync(fd) || close(fd)) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	printf("%s: %llu blocks, %llu inodes, data from block %u\n", argv[optind],
+	       (unsigned long long)nr_blocks, (unsigned long long)nr_inodes, data_start);
+
+	return 0;
+
+usage:
+	fprintf(stderr, "Usage: %s [-i inodes] device\n", argv[0]);
+	return 1;
+}
@@ -0,0 +1,163 @@
+/*
+ * Parallel writers to disjoint regions of one file.
+ *
+ * The file is sized up front, so every write is in place, and split into
+ * one region per thread. Each thread rewrites its region with pwrite()
+ * for the given number of passes. The aggregate throughput is printed for
+ * every thread count, one line each:
+ *
+ *	threads=4 bytes=1073741824 seconds=0.412 mib_per_sec=2485.4
+ *
+ * Usage: pwrite-bench [-s file_size_mib] [-b block_kib] [-p passes] file threads...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+struct worker {
+	pthread_t thread;
+	int fd;
+	off_t start;
+	off_t len;
+	size_t block;
+	int passes;
+	int err;
+};
+
+static void *worker_run(void *arg)
+{
+	struct worker *w = arg;
+	char *buf;
+	off_t off;
+	ssize_t ret;
+	int pass;
+
+	buf = malloc(w->block);
+	if (!buf) {
+		w->err = ENOMEM;
+		return NULL;
+	}
+	memset(buf, 0x5a, w->block);
+
+	for (pass = 0; pass < w->passes; pass++) {
+		for (off = 0; off < w->len; off += w->block) {
+			ret = pwrite(w->fd, buf, w->block, w->start + off);
+			if (ret != (ssize_t)w->block) {
+				w->err = ret < 0 ? errno : EIO;
+				goto out;
+			}
+		}
+	}
+
+out:
+	free(buf);
+	return NULL;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int run(int fd, off_t size, size_t block, int passes, int nr_threads)
+{
+	struct worker *workers;
+	off_t region = size / nr_threads / block * block;
+	double start, elapsed;
+	int i, err = 0;
+
+	if (!region) {
+		fprintf(stderr, "file too small for %d threads\n", nr_threads);
+		return -1;
+	}
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (!workers)
+		return -1;
+
+	start = now();
+	for (i = 0; i < nr_threads; i++) {
+		workers[i].fd = fd;
+		workers[i].start = i * region;
+		workers[i].len = region;
+		workers[i].block = block;
+		workers[i].passes = passes;
+		if (pthread_create(&workers[i].thread, NULL, worker_run, &workers[i])) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		if (workers[i].err)
+			err = workers[i].err;
+	}
+	elapsed = now() - start;
+
+	if (err) {
+		fprintf(stderr, "pwrite: %s\n", strerror(err));
+	} else {
+		printf("threads=%d bytes=%lld seconds=%.3f mib_per_sec=%.1f\n", nr_threads,
+		       (long long)region * nr_threads * passes, elapsed,
+		       region * nr_threads * passes / elapsed / (1 << 20));
+	}
+
+	free(workers);
+	return err ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	off_t size = 256 << 20;
+	size_t block = 64 << 10;
+	int passes = 4;
+	int fd, i, opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "s:b:p:")) != -1) {
+		switch (opt) {
+		case 's':
+			size = (off_t)atol(optarg) << 20;
+			break;
+		case 'b':
+			block = (size_t)atol(optarg) << 10;
+			break;
+		case 'p':
+			passes = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind + 2 > argc || !size || !block || passes <= 0)
+		goto usage;
+
+	fd = open(argv[optind], O_RDWR | O_CREAT, 0644);
+	if (fd < 0 || ftruncate(fd, size)) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	for (i = optind + 1; i < argc; i++) {
+		if (atoi(argv[i]) <= 0)
+			goto usage;
+		if (run(fd, size, block, passes, atoi(argv[i])))
+			ret = 1;
+	}
+
+	close(fd);
+	return ret;
+
+usage:
+	fprintf(stderr, "usage: %s [-s file_size_mib] [-b block_kib] [-p passes] file threads...\n",
+		argv[0]);
+	return 2;
+}